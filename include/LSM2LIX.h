@@ -3,7 +3,13 @@
 
 #include <string>
 #include <map>
+#include <set>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <shared_mutex>
+#include <unordered_set>
 
 #include "rocksdb/db.h"
 #include "rocksdb/sst_file_reader.h"
@@ -11,16 +17,27 @@
 #include "rocksdb/options.h"
 #include "rocksdb/table.h"
 #include "rocksdb/filter_policy.h"
+#include "rocksdb/write_batch.h"
 #include "treeline/pg_db.h"
 #include "treeline/pg_stats.h"
 #include "status.h"
 #include "reader.h"
 #include "log_table.h"
+#include "key_index.h"
+#include "key_partitioner.h"
+#include "meta_table.h"
+#include "handle_cache.h"
+#include "lru_cache.h"
+#include "file_cache.h"
+#include "residency_filter.h"
+#include "thread_pool.h"
+#include "hotness_tracker.h"
+#include "frequency_sketch.h"
 
 #define LSM_dir "LSM"
 #define LIX_dir "LIX"
 
-#define ColumnFamilyCnt 4
+#define ColumnFamilyCnt 4 // Default partition count; also the layout of DBs created before it was persisted.
 
 using ROCKSDB_NAMESPACE::SstFileWriter;
 using ROCKSDB_NAMESPACE::SstFileReader;
@@ -50,60 +67,419 @@ enum Flag {
 enum MetaOp {
     insert = 0,
     modify = 1,
-    remove = 2
+    remove = 2,
+    setting = 3,
+    partition = 4
 };
 
-struct SSTableMeta {
-    uint64_t SST_ID; // The id assigned by LSM-tree
-    uint64_t cf_id;
-    uint64_t smallest_key;
-    uint64_t largest_key;
-    uint64_t flag;
+// Which split points a partition record of the mLog carries.
+enum SplitsKind {
+    kCurrentSplits = 0,
+    kPreviousSplits = 1
+};
+
+// Open-time settings that fix the on-disk layout, persisted in the mLog.
+enum Setting {
+    kPartitionCnt = 0,
+    kLIXPartitionCnt = 1,
+    kHandleFormat = 2,
+    kInlineValues = 3,
+    kNextTransID = 4 // High-water mark of the transfer ids, as the mLog rewrite drops removed ones
+};
+
+// How block handles are stored in LIX.
+enum HandleFormat {
+    kCompactHandles = 0, // 8 bytes: 18-bit file number, 30-bit offset, 16-bit size
+    kVersionedHandles = 1, // Compact when the handle fits, 16 bytes wide otherwise
+    kPackedHandles = 2 // Also 5 or 6 bytes for blocks of aligned SSTs, see KeyIndex::FitsPackedHandle
+};
+
+struct LSM2LIXOptions {
+    // Number of LSM-trees (column families) the key space is partitioned into.
+    // Only used when creating a DB; an existing DB keeps its persisted value.
+    uint32_t num_partitions = ColumnFamilyCnt;
+
+    // Sample the keys of writes and move the partition boundaries to their
+    // quantiles when one LSM-tree receives a disproportionate share of them.
+    bool adaptive_partitioning = false;
+    // Sample one out of every partition_sample_interval writes.
+    uint32_t partition_sample_interval = 64;
+    // Rebalance once the busiest partition gets this many times its fair share.
+    double rebalance_threshold = 2.0;
+
+    // Number of learned index (TreeLine) instances. Each one serves an even
+    // slice of the key space, so transfers touching different slices update
+    // their indexes in parallel. Only used when creating a DB.
+    uint32_t lix_partitions = 1;
+
+    // Block handle format of a new DB. DBs created before it was persisted
+    // use kCompactHandles, whose transfers stop at 256K files, 1GB files or
+    // 64KB blocks; a versioned DB stores the handles beyond them wide.
+    // kPackedHandles writes the SSTs with block_align and without compression,
+    // and stores most handles in 5 bytes, shrinking the LIX values by 37%.
+    // Transfer ids are never reused, so only the first 16K transferred files
+    // get 5-byte handles, the next ones up to 4M get 6 bytes, and later ones
+    // are stored wide. Packing also needs files of at most 64MB.
+    HandleFormat handle_format = kVersionedHandles;
+
+    // Transfer values shorter than this into LIX itself instead of their
+    // block handle, so reading them needs no data block I/O. Only a DB
+    // created with a non-zero value tags its LIX values to allow this.
+    size_t inline_value_bytes = 0;
+
+    // Pad the data blocks of the SSTs so that each starts on a 4KB boundary
+    // (block_align), and read the blocks through LIX with direct I/O, one
+    // aligned read per block. Disables compression. kPackedHandles aligns the
+    // blocks too, but reads them through the page cache unless this is set.
+    bool align_data_blocks = false;
+
+    // Read the transferred files through LIX from memory mappings, kept for
+    // up to this many recently read files, instead of with a pread per
+    // block. Meant for files that fit in memory: warm lookups then make no
+    // system calls and copy no blocks. Zero disables mmap reads.
+    size_t max_mapped_files = 0;
+    // Advise the kernel that mappings are read at random, which disables
+    // readahead. Turn off when Gets mostly come in key order.
+    bool mmap_random_access = true;
+
+    // Compression of the SSTs, kept by the files transferred from them. The
+    // LSM-trees have a single level, which is also their bottommost one.
+    // Reading compressed blocks through LIX needs the codec built into
+    // LSM2LIX too (-DSNAPPY, -DLZ4, -DZSTD). Ignored with kPackedHandles.
+    ROCKSDB_NAMESPACE::CompressionType sst_compression = ROCKSDB_NAMESPACE::kNoCompression;
+    // Memory for caching data blocks that were read compressed through LIX,
+    // in their decompressed form. Zero disables the cache.
+    size_t decompressed_block_cache_bytes = 0;
+    // Check the crc32c of every data block read through LIX.
+    bool verify_block_checksums = false;
+
+    // Records of the learned index cached in memory, per LIX instance. Zero
+    // bypasses the cache so that every index lookup reads its page from disk.
+    // TreeLine always keeps its segment models in memory, so a cached lookup
+    // does no I/O before the data block read.
+    size_t lix_cache_records = 0;
+
+    // Memory for caching the block handle of recently read keys, so that hot
+    // keys skip the learned index entirely. Zero disables the cache.
+    size_t handle_cache_bytes = 0;
+
+    // Memory for caching values read through the LIX path. A Put of the same
+    // key invalidates the entry. Zero disables the row cache.
+    size_t row_cache_bytes = 0;
+    // Cache a value only when its key is read a second time within a window.
+    bool row_cache_admission_filter = true;
+
+    // Memory per partition for a filter of the keys written to its LSM-tree
+    // since it was last rebuilt. Get goes straight to LIX for keys the filter
+    // rules out. The filter is rebuilt from the tree after transfers, and on
+    // open. Zero disables it.
+    size_t residency_filter_bytes = 0;
+
+    // Start the LIX lookup of a Get in the background while the LSM-trees are
+    // searched, and keep its result only when they miss. Trades extra block
+    // reads for lower tail latency on keys that live in LIX.
+    bool speculative_lix_reads = false;
+    // Threads running the speculative lookups.
+    size_t speculative_threads = 4;
+
+    // Sample the keys read from and written to each LSM-tree, and transfer
+    // the SSTs with the fewest sampled accesses per byte first, so that hot
+    // ranges keep the block cache and bloom filters of the LSM-tree.
+    bool hotness_aware_transfer = false;
+    // Sample one out of every hotness_sample_interval accesses.
+    uint32_t hotness_sample_interval = 16;
+
+    // Write keys read through LIX at least this many times recently back into
+    // the LSM-tree owning them, in the background, so that they are served
+    // from the memtable and block cache again. Zero disables promotion.
+    uint32_t promotion_threshold = 0;
+    // Memory of the sketch counting reads through LIX per key.
+    size_t promotion_sketch_bytes = 1 << 20;
+
+    // Rewrite a transferred file once fewer than this fraction of its entries
+    // are still indexed by LIX, i.e. the rest were superseded by files
+    // transferred later. Zero disables garbage collection.
+    double gc_live_ratio = 0;
+
+    // After transfers, merge key-adjacent transferred files of a column family
+    // smaller than this into files of up to the target SST size, so that
+    // fewer transfer ids and file descriptors are in use. Zero disables it.
+    uint64_t merge_file_bytes = 0;
+};
+
+struct LSM2LIXStats {
+    // LIX lookups started before the LSM-trees were searched.
+    uint64_t speculative_lix_reads = 0;
+    // Speculative lookups whose result was dropped, and the data block bytes they read.
+    uint64_t wasted_lix_reads = 0;
+    uint64_t wasted_block_bytes = 0;
+    // Keys written back into an LSM-tree because they were read often through LIX.
+    uint64_t promoted_keys = 0;
+    // Transferred files rewritten or dropped by garbage collection, and the space it freed.
+    uint64_t gc_files_rewritten = 0;
+    uint64_t gc_bytes_reclaimed = 0;
 };
 
 class LSM2LIX {
     public:
     static Status Open(std::string& DB_path, LSM2LIX** db_out);
+    static Status Open(const LSM2LIXOptions& options, std::string& DB_path, LSM2LIX** db_out);
     LSM2LIX(std::string& DB_path);
+    LSM2LIX(const LSM2LIXOptions& lsm2lix_options, std::string& DB_path);
     ~LSM2LIX();
 
     Status Put(const ROCKSDB_NAMESPACE::Slice& key, const ROCKSDB_NAMESPACE::Slice& value);
     Status Get(const ROCKSDB_NAMESPACE::Slice& key, std::string* value);
+    // Integer keys are stored big-endian (KeyIndex::IntKeyAsSlice), so their byte
+    // order matches their numeric order, and they route without being parsed.
+    Status Put(uint64_t key, const ROCKSDB_NAMESPACE::Slice& value);
+    Status Get(uint64_t key, std::string* value);
+    // Like Get, but without copying the value where it can be pinned instead:
+    // in the block cache of an LSM-tree, or in the data block read through LIX,
+    // which stays alive until value is reset or destroyed.
+    Status Get(const ROCKSDB_NAMESPACE::Slice& key, ROCKSDB_NAMESPACE::PinnableSlice* value);
+    Status Get(uint64_t key, ROCKSDB_NAMESPACE::PinnableSlice* value);
+    // Looks up a batch of keys in stages, so that their cache and device misses
+    // overlap: each LSM-tree is searched with one MultiGet, and for the keys it
+    // misses the handle cache sets are prefetched before the LIX handles are
+    // looked up, all data blocks are prefetched, and then the blocks are read
+    // in groups, whose searches advance in lockstep: the hash buckets or
+    // restart arrays of all their keys are prefetched, then the restart
+    // entries, then the first entries, before any key is searched.
+    void MultiGet(size_t num_keys, const ROCKSDB_NAMESPACE::Slice* keys,
+                  ROCKSDB_NAMESPACE::PinnableSlice* values, Status* statuses);
+    // Applies the puts of updates atomically, each in the LSM-tree owning its key.
+    // Other operation types are not supported and fail the whole batch.
+    Status Write(ROCKSDB_NAMESPACE::WriteBatch* updates);
+    // Loads the pairs of iter straight into transferred files indexed by LIX,
+    // bypassing the LSM-trees. Meant for initial loads: keys must be strictly
+    // increasing, and a key already in an LSM-tree keeps shadowing its ingested
+    // value. On error, the files finished before it stay loaded.
+    Status IngestSorted(ROCKSDB_NAMESPACE::Iterator* iter);
     Status BatchUpdate_LIX(std::vector<tl::pg::Record>& pairs, uint64_t old_id, uint64_t new_id, uint32_t cf_id, bool redo = false);
+    // Called once the SST of file_id is detached and renamed to its .tsst name.
+    void MarkDetached(uint64_t file_id);
     void Set_mLogWriter(LOG::LOG_Writer* mLogWriter);
+    uint32_t PartitionCount() const { return partition_cnt_; }
+    // Move the partition boundaries to the sampled key distribution and
+    // migrate the affected ranges between column families.
+    Status Rebalance();
+    // Transfers run between these two calls, which keep a migration from starting.
+    void LockTransfer();
+    void UnlockTransfer();
+    // False while the column family is handing keys in the range over to another one.
+    bool MayTransferRange(uint32_t cf_id, uint64_t smallest_key, uint64_t largest_key);
+    // Called by the mover after SSTs of the column family were detached;
+    // detached_ranges holds the smallest and largest key_num of each.
+    void OnTransferDone(uint32_t cf_id, const std::vector<std::pair<uint64_t, uint64_t>>& detached_ranges);
+    // Hands out the id of the next transferred (.tsst) file.
+    uint64_t NewTransID() { return next_trans_id_.fetch_add(1); }
+    KeyIndex::ValueEncoding GetValueEncoding() const {
+        KeyIndex::ValueEncoding encoding;
+        encoding.allow_packed = handle_format_ == kPackedHandles;
+        encoding.allow_wide = handle_format_ != kCompactHandles;
+        encoding.tagged = inline_values_;
+        encoding.inline_limit = lsm2lix_options_.inline_value_bytes;
+        return encoding;
+    }
+    bool HotnessAwareTransfer() const { return hotness_ != nullptr; }
+    bool PromotionEnabled() const { return promotion_sketch_ != nullptr; }
+    // Queues the hot keys among those of a transferred SST for promotion, which
+    // writes them back into the LSM-trees in the background.
+    void KeepHotKeys(const std::vector<std::string>& keys);
+    // Picks the coldest bottom-level SST of the column family while that level
+    // is larger than threshold, skipping the file numbers in tried. Returns
+    // false when nothing needs to move.
+    bool SelectColdTransFile(uint32_t cf_id, uint64_t threshold, const std::unordered_set<uint64_t>& tried, uint64_t* old_id);
+    void GetStats(LSM2LIXStats* stats) const;
+    // Check every transferred file now and rewrite those below gc_live_ratio.
+    Status GarbageCollect();
+    // Merge the transferred files smaller than merge_file_bytes now.
+    Status MergeSmallFiles();
 
     private:
 
+    enum SpeculativeStage {
+        kSpecRunning = 0,
+        kSpecFinished = 1,
+        kSpecDiscarded = 2
+    };
+
+    // State of a speculative LIX lookup, shared by Get and the task running it.
+    struct SpeculativeRead {
+        std::string key;
+        std::string value;
+        Status status;
+        uint64_t block_bytes = 0;
+        uint64_t epoch = 0; // lix_epoch_ when the lookup started
+        std::atomic<int> stage{kSpecRunning};
+        std::promise<void> finished;
+        std::shared_future<void> done;
+    };
+
+    class BatchDispatcher;
+    Status PutImpl(uint64_t key_num, const ROCKSDB_NAMESPACE::Slice& key, const ROCKSDB_NAMESPACE::Slice& value);
+    Status GetImpl(uint64_t key_num, const ROCKSDB_NAMESPACE::Slice& key, ROCKSDB_NAMESPACE::PinnableSlice* value);
+    // Callers hold dispatch_mutex_ shared until batch is written.
+    void DispatchPut(uint64_t key_num, const ROCKSDB_NAMESPACE::Slice& key,
+                     const ROCKSDB_NAMESPACE::Slice& value, ROCKSDB_NAMESPACE::WriteBatch* batch,
+                     bool promotion = false);
+    // Registers a finished ingest file and appends its pairs to run, which the
+    // caller loads into LIX with FlushIngestRun().
+    Status FinishIngestFile(SstFileWriter* writer, uint64_t file_id, uint32_t partition_num, uint64_t smallest_key,
+                            uint64_t largest_key, std::vector<tl::pg::Record>* run,
+                            std::vector<std::unique_ptr<char[]>>* offset_values);
+    // Loads run into LIX instance lix_num, drops the cached entries of its keys
+    // and releases the buffers behind it.
+    Status FlushIngestRun(uint32_t lix_num, std::vector<tl::pg::Record>* run,
+                          std::vector<std::unique_ptr<char[]>>* offset_values, std::vector<std::string>* keys);
+    void MaybePromote(const ROCKSDB_NAMESPACE::Slice& key, uint64_t key_num);
+    void PromoteQueuedKeys();
+    // Writes the LIX value of the keys missing from the LSM-trees back into the
+    // trees owning them, unless a key is written meanwhile. Returns the keys written.
+    uint64_t PromoteKeys(const std::vector<std::string>& keys);
+    size_t WriteStripe(uint64_t key_num) const;
+    // Called once the writes of DispatchPut() for these keys returned.
+    void FinishDispatch(const uint64_t* key_nums, size_t count);
+    Status GetFromLIX(const ROCKSDB_NAMESPACE::Slice& key, uint64_t key_num, std::string* value, uint64_t* block_bytes = nullptr);
+    Status GetFromLIX(const ROCKSDB_NAMESPACE::Slice& key, uint64_t key_num, ROCKSDB_NAMESPACE::PinnableSlice* value,
+                      uint64_t* block_bytes = nullptr);
+    Status ReadThroughLIX(const ROCKSDB_NAMESPACE::Slice& key, uint64_t key_num, ROCKSDB_NAMESPACE::PinnableSlice* value,
+                          uint64_t* block_bytes, bool* file_missing);
+    // The block handle LIX holds for key_num, or its value when inlined.
+    Status LookupBlockHandle(uint64_t key_num, uint64_t* filenum, uint64_t* offset, uint64_t* size,
+                             bool* is_inline, std::string* inline_value);
+    // Reads a block of a transferred file into datablock_reader, from the decompressed block cache if there.
+    Status ReadLIXBlock(uint64_t filenum, BlockHandle& handle, Reader* datablock_reader, bool* file_missing);
+    void MultiGetFromLIX(const ROCKSDB_NAMESPACE::Slice* keys, const uint64_t* key_nums, const std::vector<size_t>& indexes,
+                         ROCKSDB_NAMESPACE::PinnableSlice* values, Status* statuses);
+    Status PinFromBlock(Reader* datablock_reader, const ROCKSDB_NAMESPACE::Slice& key, ROCKSDB_NAMESPACE::PinnableSlice* value);
+    // Id of the transferred file LIX maps key_num to, or kNoSSTID.
+    uint64_t LIXFileOf(uint64_t key_num);
+    // Queues files that lost entries to a transfer for CollectGarbage().
+    void ScheduleGC(const std::vector<uint64_t>& file_ids);
+    // Rewrites the candidates below gc_live_ratio, going by their live-entry
+    // counters; with recount, or when a counter is unknown, the file is scanned.
+    Status CollectGarbage(const std::vector<uint64_t>& candidates, bool recount);
+    Status CountLiveEntries(uint64_t file_id, uint64_t* live, uint64_t* total);
+    // Copy the live entries of the files into a new one, point LIX at it and delete them.
+    Status RewriteTransFiles(const std::vector<uint64_t>& file_ids);
+    void RemoveTransFile(uint64_t file_id);
+    std::shared_ptr<SpeculativeRead> StartSpeculativeRead(const ROCKSDB_NAMESPACE::Slice& key, uint64_t key_num);
+    void DiscardSpeculativeRead(const std::shared_ptr<SpeculativeRead>& spec);
     Status RecoverStageI();
     Status RecoverStageII();
     Status RecovermLogFile();
     Status RecovertLogFile(std::vector<uint64_t>* todolist);
     void ExtractTodoList(std::vector<uint64_t>* todolist);
+    Status LogSetting(uint64_t setting_id, uint64_t value);
+    Status LogSplits(uint64_t kind, const std::vector<uint64_t>& splits);
+    Status MigratePartitions();
+    Status MigrateRange(uint64_t lower, uint64_t upper, bool to_end);
+    void MaybeScheduleRebalance();
+    uint32_t PartitionOfCF(uint32_t cf_id) const;
+    void NoteResidency(uint32_t partition_num, uint64_t key_num);
+    bool MayResideInLSM(uint32_t partition_num, uint64_t key_num) const;
+    void ScheduleResidencyRebuild(uint32_t partition_num);
+    void ScheduleResidencyReset(uint32_t partition_num, uint64_t smallest_key, uint64_t largest_key);
+    void ScheduleResidencyWork(uint32_t partition_num);
+    void RebuildResidencyFilter(uint32_t partition_num);
+    void ResetResidencyRanges(uint32_t partition_num, std::vector<std::pair<uint64_t, uint64_t>> ranges);
 
     uint32_t DispatchRequest(uint64_t key_num, uint32_t tree_num);
+    uint32_t LIXOf(uint64_t key_num) { return DispatchRequest(key_num, lix_cnt_); }
 
-    DB* db_;
+    LSM2LIXOptions lsm2lix_options_;
+    uint32_t partition_cnt_;
+    KeyPartitioner partitioner_;
+    mutable std::shared_mutex dispatch_mutex_; // Guards the split points of partitioner_
+    std::shared_mutex transfer_mutex_; // Held shared by each transfer, exclusively to start a migration
+    std::mutex rebalance_mutex_;
+    // Keys written to a migrating range and not migrated yet. A migration batch
+    // skips them, as the writer already moved them to their new owner. Keys below
+    // migrate_done_below_ are not read again, so they are neither kept nor added.
+    std::mutex migrate_mutex_;
+    std::set<std::string> migrate_dirty_;
+    std::string migrate_done_below_;
+    std::atomic<bool> rebalance_scheduled_{false};
+    ThreadPool* bg_pool_ = nullptr;
+    ThreadPool* spec_pool_ = nullptr;
+    std::atomic<size_t> speculative_inflight_{0};
+    std::atomic<uint64_t> speculative_reads_{0};
+    std::atomic<uint64_t> speculative_wasted_{0};
+    std::atomic<uint64_t> speculative_wasted_bytes_{0};
+    std::atomic<uint64_t> lix_epoch_{0}; // Bumped after every batch of keys enters LIX
+    DB* db_ = nullptr;
     std::vector<ColumnFamilyHandle*> handles_;
     Options options_;
     ReadOptions ropts_;
     WriteOptions wopts_;
-    tl::pg::PageGroupedDB* tldb_;
+    uint32_t lix_cnt_;
+    uint64_t handle_format_;
+    bool inline_values_; // LIX values carry a tag byte, see KeyIndex::ValueEncoding
+    std::vector<tl::pg::PageGroupedDB*> tldbs_;
     // Reader datablock_reader_;
     // std::map<uint64_t, uint64_t> TransId2SstId_; // new id - old id
     // std::map<uint64_t, uint64_t> TransId2DirId_; // new id - dir id
     // std::vector<std::string> TransFile_dir_;
-    std::map<uint64_t, SSTableMeta> TransID2SSTMeta_; // Metatable
+    MetaTable TransID2SSTMeta_; // Metatable
+    std::atomic<uint64_t> next_trans_id_{0};
     std::string DB_path_;
     std::string LSM_path_;
     std::string LIX_path_;
 
     mutable std::shared_mutex mutex_;
-    bool bulkload_ = false;
+    HandleCache* handle_cache_ = nullptr;
+    LRUCache<std::string>* row_cache_ = nullptr;
+    LRUCache<std::shared_ptr<const std::string>>* block_cache_ = nullptr; // Keyed by transfer id and block offset
+    FileCache* file_cache_ = nullptr;
+    // Two filters per partition: the active one and the one being rebuilt.
+    // The flags below are protected by dispatch_mutex_.
+    std::vector<std::unique_ptr<ResidencyFilter>> residency_filters_;
+    std::vector<uint8_t> residency_active_;
+    std::vector<uint8_t> residency_rebuilding_;
+    std::vector<uint8_t> residency_ready_;
+    // Work queued per partition, protected by residency_mutex_: a full
+    // rebuild, or the key ranges of detached SSTs to reset.
+    std::mutex residency_mutex_;
+    std::vector<uint8_t> residency_scheduled_;
+    std::vector<uint8_t> residency_full_;
+    std::vector<std::vector<std::pair<uint64_t, uint64_t>>> residency_ranges_;
+    HotnessTracker* hotness_ = nullptr;
+    FrequencySketch* promotion_sketch_ = nullptr;
+    static const size_t kMaxPromotionQueue = 4096;
+    static const size_t kPromotionBatch = 16; // Keys read per promotion write
+    static const size_t kIngestChunk = 1 << 20; // Records an ingest buffers per LIX instance
+    static const size_t kMultiGetGroup = 8; // Data blocks a MultiGet searches in lockstep
+    std::mutex promotion_mutex_;
+    std::vector<std::string> promotion_queue_;
+    bool promotion_scheduled_ = false;
+    // Writes dispatched and finished per stripe of key_nums, so a promotion can
+    // tell whether a key was written between its read and its write.
+    static const size_t kWriteStripes = 1024;
+    std::unique_ptr<std::atomic<uint64_t>[]> writes_started_;
+    std::unique_ptr<std::atomic<uint64_t>[]> writes_done_;
+    // Held by a promotion from its check through its write; writers wait for it while promoting_.
+    std::mutex promote_mutex_;
+    std::atomic<bool> promoting_{false};
+    std::atomic<uint64_t> promoted_keys_{0};
+
+    // Held shared by everything adding handles to LIX, exclusively while a rewrite remaps them.
+    std::shared_mutex lix_remap_mutex_;
+    std::mutex gc_mutex_; // One rewrite pass, GC or merge, at a time
+    std::mutex gc_queue_mutex_;
+    std::set<uint64_t> gc_candidates_;
+    bool gc_scheduled_ = false;
+    std::atomic<bool> merge_scheduled_{false};
+    std::atomic<uint64_t> gc_files_rewritten_{0};
+    std::atomic<uint64_t> gc_bytes_reclaimed_{0};
+    std::vector<bool> bulkload_; // The LIX instance is empty and must be bulk loaded first
 
     std::vector<uint64_t> todolist_;
     std::vector<uint64_t> detachlist_;
-    LOG::LOG_Writer* mLogWriter_;
-    int mlog_fd_;
+    LOG::LOG_Writer* mLogWriter_ = nullptr;
+    int mlog_fd_ = -1;
+    Status open_status_; // The first failure of the constructor, returned by Open()
 };
 
 } // namespcae
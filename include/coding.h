@@ -68,6 +68,11 @@ inline void EncodeFixed64(char* dst, uint64_t value) {
 // Lower-level versions of Get... that read directly from a character buffer
 // without any bounds checking.
 
+inline uint16_t DecodeFixed16(const char* ptr) {
+  const uint8_t* const buffer = reinterpret_cast<const uint8_t*>(ptr);
+  return static_cast<uint16_t>(buffer[0] | (buffer[1] << 8));
+}
+
 inline uint32_t DecodeFixed32(const char* ptr) {
   const uint8_t* const buffer = reinterpret_cast<const uint8_t*>(ptr);
 
@@ -105,6 +110,16 @@ inline uint64_t DecodeFixed64(const char* ptr, bool LE) {
   }
 }
 
+// Finalizer of MurmurHash3: neighbouring key_nums get unrelated hashes.
+inline uint64_t HashKeyNum(uint64_t key_num) {
+  key_num ^= key_num >> 33;
+  key_num *= 0xff51afd7ed558ccdULL;
+  key_num ^= key_num >> 33;
+  key_num *= 0xc4ceb9fe1a85ec53ULL;
+  key_num ^= key_num >> 33;
+  return key_num;
+}
+
 // Internal routine for use by fallback path of GetVarint32Ptr
 const char* GetVarint32PtrFallback(const char* p, const char* limit,
                                    uint32_t* value);
@@ -43,18 +43,25 @@ class LSM2LIX_Mover : public EventListener {
     Options options_;
     ReadOptions rdoptions_;
     CompactionOptions compact_options_;
-    std::atomic<uint64_t> counter_;
     LSM2LIX* lsm2lix_db_;
 
+    // Moves one detached SST into LIX under transfer id new_id.
+    // Returns false, leaving the SST in place, if its handles can not be encoded.
+    bool TransferFile(DB* db, uint32_t cf_id, uint64_t old_id, const std::string& old_path, uint64_t new_id,
+                      std::vector<std::pair<uint64_t, uint64_t>>* detached_ranges);
+
     public:
-    explicit LSM2LIX_Mover(int num_levels, uint64_t bottom_level_size_threshold, Options& options, LSM2LIX* db, uint64_t SST_NUM) {
+    explicit LSM2LIX_Mover(int num_levels, uint64_t bottom_level_size_threshold, Options& options, LSM2LIX* db) {
         bottom_level_ = num_levels;
         bottom_level_size_threshold_ = bottom_level_size_threshold;
-        counter_.store(SST_NUM);
         options_ = options;
         lsm2lix_db_ = db;
     }
-    static char* GetTreeLineIndexPair(std::string& filename, uint64_t filenum, Options& option, ReadOptions& rdoptions, std::vector<tl::pg::Record>* pairs);
+    // Returns the buffer the values of pairs point into, or nullptr if a block
+    // handle fits none of the layouts the encoding allows. keys, if given,
+    // receives the full user keys of the pairs.
+    static char* GetTreeLineIndexPair(std::string& filename, uint64_t filenum, Options& option, ReadOptions& rdoptions, const KeyIndex::ValueEncoding& encoding, std::vector<tl::pg::Record>* pairs,
+                                      std::vector<std::string>* keys = nullptr);
     void OnCompactionCompleted(DB* db, const CompactionJobInfo& info) override;
     
 };
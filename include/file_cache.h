@@ -0,0 +1,78 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "status.h"
+
+namespace LSM2LIX {
+
+// A read-only memory mapping of a whole file, unmapped with its last reference.
+class MappedFile {
+    public:
+    enum Access {
+        kRandom = 0, // No readahead, for point lookups
+        kSequential = 1 // Aggressive readahead, for lookups in key order
+    };
+
+    static Status Open(const std::string& filename, Access access, std::shared_ptr<MappedFile>* file);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    // Starts reading the pages of the range in the background (MADV_WILLNEED).
+    void Prefetch(uint64_t offset, size_t length) const;
+
+    private:
+    MappedFile(const char* data, size_t size) : data_(data), size_(size) {}
+
+    const char* data_;
+    size_t size_;
+};
+
+// Keeps the mappings of the most recently read files, by file name. A file
+// evicted or erased stays mapped until the readers holding it are done.
+class FileCache {
+    public:
+    FileCache(size_t max_files, MappedFile::Access access);
+
+    FileCache(const FileCache&) = delete;
+    FileCache& operator=(const FileCache&) = delete;
+
+    // Maps the file on a miss. Fails with NotFound if it does not exist.
+    Status Get(const std::string& filename, std::shared_ptr<MappedFile>* file);
+    // Call before deleting the file, so that its space is freed once unmapped.
+    void Erase(const std::string& filename);
+
+    private:
+    static const size_t kNumShards = 16;
+
+    typedef std::list<std::pair<std::string, std::shared_ptr<MappedFile>>> LRUList;
+
+    struct Shard {
+        std::mutex mutex;
+        LRUList lru;
+        std::unordered_map<std::string, LRUList::iterator> table;
+        size_t capacity = 0;
+        uint64_t version = 0; // Bumped by Erase(), so a mapping opened before it is not cached
+    };
+
+    Shard& ShardOf(const std::string& filename) {
+        return shards_[std::hash<std::string>()(filename) % kNumShards];
+    }
+
+    const MappedFile::Access access_;
+    Shard shards_[kNumShards];
+};
+
+} // namespace
+
+#endif
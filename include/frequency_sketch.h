@@ -0,0 +1,43 @@
+#ifndef FREQUENCY_SKETCH_H
+#define FREQUENCY_SKETCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace LSM2LIX {
+
+// A count-min sketch of 8-bit saturating counters, estimating how often a
+// key_num was seen recently. Once the number of increments reaches ten times
+// the width, every counter is halved, so old popularity fades.
+//
+// Counters are updated without locks; a racing increment may be lost, which
+// only makes the estimate slightly low.
+class FrequencySketch {
+    public:
+    explicit FrequencySketch(size_t num_bytes);
+
+    FrequencySketch(const FrequencySketch&) = delete;
+    FrequencySketch& operator=(const FrequencySketch&) = delete;
+
+    // Count one more sighting of key_num and return its estimated frequency.
+    uint32_t Increment(uint64_t key_num);
+    // The estimated frequency of key_num, without counting a sighting.
+    uint32_t Estimate(uint64_t key_num) const;
+
+    private:
+    static const int kDepth = 4;
+
+    size_t Index(uint64_t hash, int row) const;
+    void Age();
+
+    size_t width_;
+    uint64_t sample_size_;
+    std::atomic<uint64_t> additions_{0};
+    std::unique_ptr<std::atomic<uint8_t>[]> counters_;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef HANDLE_CACHE_H
+#define HANDLE_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace LSM2LIX {
+
+// A set-associative cache from key_num to the packed block handle stored in
+// the learned index, so that hot keys skip the index lookup.
+//
+// Each set holds kWays (key, handle) slots in one cache line and is guarded
+// by a sequence lock: readers never block, writers are serialized by striped
+// mutexes. A handle of 0 marks an empty slot (a real handle has a non-zero size).
+class HandleCache {
+    public:
+    explicit HandleCache(size_t capacity_bytes);
+    ~HandleCache();
+
+    HandleCache(const HandleCache&) = delete;
+    HandleCache& operator=(const HandleCache&) = delete;
+
+    // *version is set whether or not the key is found. Pass it to Insert()
+    // so that a handle read from the index before a concurrent Erase() of
+    // the same set is not cached.
+    bool Lookup(uint64_t key_num, uint64_t* handle, uint64_t* version) const;
+    void Insert(uint64_t key_num, uint64_t handle, uint64_t version);
+    // Loads the set of key_num into the CPU cache ahead of a Lookup().
+    void Prefetch(uint64_t key_num) const;
+    // Call after the index entry of key_num has been rewritten.
+    void Erase(uint64_t key_num);
+
+    private:
+    static const size_t kWays = 4;
+    static const size_t kLockStripes = 64;
+
+    struct alignas(64) Set {
+        std::atomic<uint64_t> keys[kWays];
+        std::atomic<uint64_t> handles[kWays];
+    };
+
+    size_t SetOf(uint64_t key_num) const;
+
+    Set* sets_;
+    std::atomic<uint64_t>* versions_; // Odd while the set is being written
+    size_t num_sets_;
+    std::mutex locks_[kLockStripes];
+};
+
+} // namespace
+
+#endif
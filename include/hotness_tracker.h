@@ -0,0 +1,54 @@
+#ifndef HOTNESS_TRACKER_H
+#define HOTNESS_TRACKER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace LSM2LIX {
+
+// Tracks which key ranges of each partition are being accessed, so that
+// transfers can leave the hot SSTs in the LSM-tree.
+//
+// Accesses are sampled into a ring of the most recent key numbers per
+// partition and access kind; older accesses age out as the ring wraps.
+// Mapping a key to its SST on every access would need a search of the
+// level, so the samples are attributed to SSTs only when a victim is chosen,
+// by counting the samples inside each file's key range.
+class HotnessTracker {
+    public:
+    HotnessTracker(uint32_t num_partitions, uint32_t sample_interval);
+
+    HotnessTracker(const HotnessTracker&) = delete;
+    HotnessTracker& operator=(const HotnessTracker&) = delete;
+
+    // Record one access with probability 1 / sample_interval.
+    void RecordRead(uint32_t partition_num, uint64_t key_num) { Record(partition_num, key_num, 0); }
+    void RecordWrite(uint32_t partition_num, uint64_t key_num) { Record(partition_num, key_num, 1); }
+
+    // Sorted copies of the sampled reads and writes of a partition.
+    void Snapshot(uint32_t partition_num, std::vector<uint64_t>* reads, std::vector<uint64_t>* writes) const;
+
+    // Number of the sorted samples in [smallest_key, largest_key].
+    static uint64_t CountInRange(const std::vector<uint64_t>& samples, uint64_t smallest_key, uint64_t largest_key);
+
+    private:
+    static const size_t kRingSize = 4096;
+    static const uint64_t kEmptySlot = UINT64_MAX;
+
+    struct Ring {
+        std::atomic<uint64_t> next{0};
+        std::unique_ptr<std::atomic<uint64_t>[]> slots;
+    };
+
+    void Record(uint32_t partition_num, uint64_t key_num, int kind);
+    void Copy(const Ring& ring, std::vector<uint64_t>* samples) const;
+
+    uint32_t sample_interval_;
+    std::vector<Ring> rings_; // Two per partition: reads, then writes
+};
+
+} // namespace
+
+#endif
@@ -1,7 +1,9 @@
-#ifndef KEY_INDEXX_H
-#define KEY_INNDEX_H
+#ifndef KEY_INDEX_H
+#define KEY_INDEX_H
 
 #include <stdint.h>
+#include <cstring>
+#include <string>
 #include <tuple>
 
 namespace KeyIndex {
@@ -10,6 +12,27 @@ namespace KeyIndex {
 #define SST_BITS                18  //256K 1024MB SSTable files
 #define DATABLOCK_BITS          30  //16K 64KB data blocks per SSTable file
 #define DATABLOCK_SIZE_BITS     16  //64KB data block size    
+#define WIDE_OFFSET_LENGTH      16  //16B: 32-bit file number, 32-bit block size, 64-bit offset
+#define PACKED_OFFSET_LENGTH    5   //5B: 14-bit file number, 14-bit offset in 4KB units, 12-bit block size
+#define PACKED_SST_BITS         14
+#define PACKED_UNIT_BITS        14  //64MB files
+#define PACKED_SIZE_BITS        12  //Blocks within one 4KB page
+#define PACKED_UNIT_SIZE        4096
+#define PACKED_WIDE_OFFSET_LENGTH 6 //6B: the packed layout with a 22-bit file number
+#define PACKED_WIDE_SST_BITS    22  //4M files, once the ids outgrow PACKED_SST_BITS
+
+#define INLINE_TAG              1   //Tag of a LIX value holding the value itself
+#define HANDLE_TAG              0   //Tag of a LIX value holding a block handle
+
+// What the LIX values of a DB may hold, fixed by its persisted settings.
+struct ValueEncoding {
+  bool allow_packed = false;
+  bool allow_wide = false;
+  // Every LIX value starts with a tag byte, and values shorter than
+  // inline_limit are stored there in place of their block handle.
+  bool tagged = false;
+  size_t inline_limit = 0;
+};
 
 class IntKeyAsSlice {
     public:
@@ -78,6 +101,19 @@ static uint64_t ExtractHead64(const SliceKind& key) {
   }
 }
 
+// The shortest string key whose ExtractHead64() is not below key_num, i.e.
+// key_num in big-endian byte order without its trailing zero bytes.
+inline std::string LowerBoundKey(uint64_t key_num) {
+  char buf[sizeof(uint64_t)];
+  uint64_t swapped = __builtin_bswap64(key_num);
+  memcpy(buf, &swapped, sizeof(swapped));
+  size_t length = sizeof(swapped);
+  while (length > 0 && buf[length - 1] == 0) {
+    length--;
+  }
+  return std::string(buf, length);
+}
+
 class BlockHandleAsOffset {
     public:
     BlockHandleAsOffset(uint64_t filenum, uint64_t offset, uint64_t size) {
@@ -127,5 +163,96 @@ inline void OffsetToBlockHandle(char input_value[OFFSET_LENGTH], uint64_t* filen
   *size = *input_uint & 0xFFFF;
 }
 
+inline bool FitsCompactHandle(uint64_t filenum, uint64_t offset, uint64_t size) {
+  return filenum < (1ULL << SST_BITS) && offset < (1ULL << DATABLOCK_BITS) && size < (1ULL << DATABLOCK_SIZE_BITS);
+}
+
+// Only blocks starting on a 4KB boundary, as written with block_align, can be
+// packed. The 5-byte layout holds the first 16K transfer ids; later ones take
+// the 6-byte layout, which holds 4M, before falling back to 8 bytes.
+inline bool FitsPackedHandle(uint64_t filenum, uint64_t offset, uint64_t size, int sst_bits = PACKED_SST_BITS) {
+  return filenum < (1ULL << sst_bits) && offset % PACKED_UNIT_SIZE == 0 &&
+         offset / PACKED_UNIT_SIZE < (1ULL << PACKED_UNIT_BITS) && size < (1ULL << PACKED_SIZE_BITS);
+}
+
+inline void BlockHandleToPackedOffset(uint64_t filenum, uint64_t offset, uint64_t size, char* result_value,
+                                      size_t length = PACKED_OFFSET_LENGTH) {
+  uint64_t packed = ( filenum << ( PACKED_UNIT_BITS + PACKED_SIZE_BITS ))
+                  | (( offset / PACKED_UNIT_SIZE ) << PACKED_SIZE_BITS )
+                  | size;
+  for (size_t i = 0; i < length; i++) {
+    result_value[i] = static_cast<char>(packed >> (8 * i));
+  }
+}
+
+inline void PackedOffsetToBlockHandle(const char* input_value, uint64_t* filenum, uint64_t* offset, uint64_t* size,
+                                      size_t length = PACKED_OFFSET_LENGTH) {
+  uint64_t packed = 0;
+  for (size_t i = 0; i < length; i++) {
+    packed |= static_cast<uint64_t>(static_cast<unsigned char>(input_value[i])) << (8 * i);
+  }
+  *filenum = packed >> ( PACKED_UNIT_BITS + PACKED_SIZE_BITS );
+  *offset = (( packed >> PACKED_SIZE_BITS ) & (( 1ULL << PACKED_UNIT_BITS ) - 1 )) * PACKED_UNIT_SIZE;
+  *size = packed & (( 1ULL << PACKED_SIZE_BITS ) - 1 );
+}
+
+inline void BlockHandleToWideOffset(uint64_t filenum, uint64_t offset, uint64_t size, char result_value[WIDE_OFFSET_LENGTH]) {
+  uint64_t head = (( filenum & 0xFFFFFFFF ) << 32 ) | ( size & 0xFFFFFFFF );
+  memcpy(result_value, &head, sizeof(head));
+  memcpy(result_value + sizeof(head), &offset, sizeof(offset));
+}
+
+inline void WideOffsetToBlockHandle(const char input_value[WIDE_OFFSET_LENGTH], uint64_t* filenum, uint64_t* offset, uint64_t* size) {
+  uint64_t head = LoadUnaligned<uint64_t>(input_value);
+  *filenum = head >> 32;
+  *size = head & 0xFFFFFFFF;
+  *offset = LoadUnaligned<uint64_t>(input_value + sizeof(head));
+}
+
+// Encodes the handle in the smallest allowed layout that holds it: packed,
+// compact, then wide. Returns the encoded length, or 0 if none can hold it.
+inline size_t EncodeBlockHandle(uint64_t filenum, uint64_t offset, uint64_t size, bool allow_packed, bool allow_wide, char* result_value) {
+  if (allow_packed && FitsPackedHandle(filenum, offset, size)) {
+    BlockHandleToPackedOffset(filenum, offset, size, result_value);
+    return PACKED_OFFSET_LENGTH;
+  }
+  if (allow_packed && FitsPackedHandle(filenum, offset, size, PACKED_WIDE_SST_BITS)) {
+    BlockHandleToPackedOffset(filenum, offset, size, result_value, PACKED_WIDE_OFFSET_LENGTH);
+    return PACKED_WIDE_OFFSET_LENGTH;
+  }
+  if (FitsCompactHandle(filenum, offset, size)) {
+    BlockHandleToOffset(filenum, offset, size, result_value);
+    return OFFSET_LENGTH;
+  }
+  if (allow_wide && filenum <= 0xFFFFFFFF && size <= 0xFFFFFFFF) {
+    BlockHandleToWideOffset(filenum, offset, size, result_value);
+    return WIDE_OFFSET_LENGTH;
+  }
+  return 0;
+}
+
+// The layout of an encoded handle is told apart by its length.
+inline bool DecodeBlockHandle(const char* input_value, size_t length, uint64_t* filenum, uint64_t* offset, uint64_t* size) {
+  if (length == OFFSET_LENGTH) {
+    char compact[OFFSET_LENGTH];
+    memcpy(compact, input_value, OFFSET_LENGTH);
+    OffsetToBlockHandle(compact, filenum, offset, size);
+    return true;
+  }
+  if (length == WIDE_OFFSET_LENGTH) {
+    WideOffsetToBlockHandle(input_value, filenum, offset, size);
+    return true;
+  }
+  if (length == PACKED_OFFSET_LENGTH) {
+    PackedOffsetToBlockHandle(input_value, filenum, offset, size);
+    return true;
+  }
+  if (length == PACKED_WIDE_OFFSET_LENGTH) {
+    PackedOffsetToBlockHandle(input_value, filenum, offset, size, PACKED_WIDE_OFFSET_LENGTH);
+    return true;
+  }
+  return false;
+}
+
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef KEY_PARTITIONER_H
+#define KEY_PARTITIONER_H
+
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <vector>
+
+namespace LSM2LIX {
+
+// Range-partitions the 64-bit key space across the LSM forest.
+// Partition i owns [splits[i-1], splits[i]), with an implicit 0 in front and
+// the maximum key behind. While a rebalance migrates data, the previous split
+// points are kept so that reads can fall back to the former owner of a key.
+//
+// The split points are protected by the owner (LSM2LIX::dispatch_mutex_);
+// only the sample reservoir has its own lock.
+class KeyPartitioner {
+    public:
+    KeyPartitioner() = default;
+
+    KeyPartitioner(const KeyPartitioner&) = delete;
+    KeyPartitioner& operator=(const KeyPartitioner&) = delete;
+
+    // Reset to num_partitions even slices without a migration in progress.
+    void Init(uint32_t num_partitions);
+    uint32_t NumPartitions() const { return splits_.size() + 1; }
+
+    uint32_t Route(uint64_t key_num) const { return Route(splits_, key_num); }
+    uint32_t RoutePrevious(uint64_t key_num) const { return Route(prev_splits_, key_num); }
+    bool Migrating() const { return !prev_splits_.empty(); }
+
+    const std::vector<uint64_t>& Splits() const { return splits_; }
+    const std::vector<uint64_t>& PreviousSplits() const { return prev_splits_; }
+    void SetSplits(const std::vector<uint64_t>& splits) { splits_ = splits; }
+    void SetPreviousSplits(const std::vector<uint64_t>& splits) { prev_splits_ = splits; }
+
+    // Move to new split points, remembering the current ones until FinishMigration().
+    void StartMigration(const std::vector<uint64_t>& splits);
+    void FinishMigration() { prev_splits_.clear(); }
+
+    // Record one write with probability 1 / sample_interval.
+    // Returns true when enough new samples arrived to re-check the balance.
+    bool Sample(uint64_t key_num, uint32_t sample_interval);
+
+    // Compute split points at the quantiles of the sampled keys. Returns false
+    // if no partition receives more than threshold times its fair share.
+    bool ProposeSplits(double threshold, std::vector<uint64_t>* splits);
+
+    private:
+    static uint32_t Route(const std::vector<uint64_t>& splits, uint64_t key_num);
+
+    static const size_t kReservoirSize = 4096;
+    static const uint64_t kCheckInterval = 1024;
+
+    std::vector<uint64_t> splits_;
+    std::vector<uint64_t> prev_splits_;
+
+    std::mutex sample_mutex_;
+    std::vector<uint64_t> reservoir_;
+    uint64_t seen_ = 0;
+    std::mt19937_64 rng_;
+};
+
+} // namespace
+
+#endif
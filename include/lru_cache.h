@@ -0,0 +1,153 @@
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace LSM2LIX {
+
+// A sharded LRU cache bounded by the total charge of its entries.
+//
+// Values are filled from a slower tier, which may be updated concurrently.
+// To keep a stale value out of the cache, read Version(key) before the slow
+// lookup and pass it to Insert(); Erase(key) invalidates all such stamps of
+// keys hashing to the same stripe.
+//
+// With an admission filter, a key is only cached on its second Insert()
+// within a window, which keeps one-hit wonders from flushing hot entries.
+template <class V>
+class LRUCache {
+    public:
+    LRUCache(size_t capacity_bytes, bool admission_filter)
+        : admission_filter_(admission_filter) {
+        for (size_t i = 0; i < kNumShards; i++) {
+            shards_[i].capacity = capacity_bytes / kNumShards;
+            // About one doorkeeper bit per 64 bytes of cache.
+            shards_[i].doorkeeper.assign(std::max<size_t>(shards_[i].capacity / 64 / 64, 1), 0);
+        }
+        for (size_t i = 0; i < kVersionStripes; i++) {
+            versions_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    LRUCache(const LRUCache&) = delete;
+    LRUCache& operator=(const LRUCache&) = delete;
+
+    uint64_t Version(const std::string& key) const {
+        return versions_[Hash(key) % kVersionStripes].load(std::memory_order_acquire);
+    }
+
+    bool Lookup(const std::string& key, V* value) {
+        Shard& shard = shards_[Hash(key) % kNumShards];
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto it = shard.table.find(key);
+        if (it == shard.table.end()) {
+            return false;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        *value = it->second->value;
+        return true;
+    }
+
+    void Insert(const std::string& key, const V& value, size_t charge, uint64_t version) {
+        size_t hash = Hash(key);
+        Shard& shard = shards_[hash % kNumShards];
+        charge += key.size() + kEntryOverhead;
+        if (charge > shard.capacity) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        if (versions_[hash % kVersionStripes].load(std::memory_order_acquire) != version) {
+            return; // Erased since the caller read the slower tier
+        }
+        if (admission_filter_ && !Admit(&shard, hash)) {
+            return;
+        }
+        auto it = shard.table.find(key);
+        if (it != shard.table.end()) {
+            shard.usage -= it->second->charge;
+            shard.lru.erase(it->second);
+            shard.table.erase(it);
+        }
+        shard.lru.push_front(Entry{key, value, charge});
+        shard.table.emplace(key, shard.lru.begin());
+        shard.usage += charge;
+        while (shard.usage > shard.capacity) {
+            Entry& victim = shard.lru.back();
+            shard.usage -= victim.charge;
+            shard.table.erase(victim.key);
+            shard.lru.pop_back();
+        }
+    }
+
+    void Erase(const std::string& key) {
+        size_t hash = Hash(key);
+        Shard& shard = shards_[hash % kNumShards];
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        versions_[hash % kVersionStripes].fetch_add(1, std::memory_order_acq_rel);
+        auto it = shard.table.find(key);
+        if (it != shard.table.end()) {
+            shard.usage -= it->second->charge;
+            shard.lru.erase(it->second);
+            shard.table.erase(it);
+        }
+    }
+
+    private:
+    static const size_t kNumShards = 64;
+    static const size_t kVersionStripes = 4096;
+    static const size_t kEntryOverhead = 64; // List node, table node and bookkeeping
+
+    struct Entry {
+        std::string key;
+        V value;
+        size_t charge;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<std::string, typename std::list<Entry>::iterator> table;
+        size_t usage = 0;
+        size_t capacity = 0;
+        std::vector<uint64_t> doorkeeper;
+        size_t doorkeeper_inserts = 0;
+    };
+
+    static size_t Hash(const std::string& key) { return std::hash<std::string>()(key); }
+
+    // Returns true if the key was seen before; otherwise remembers it.
+    bool Admit(Shard* shard, size_t hash) {
+        size_t bits = shard->doorkeeper.size() * 64;
+        size_t bit0 = (hash >> 6) % bits;
+        size_t bit1 = ((hash * 0x9E3779B97F4A7C15ULL) >> 32) % bits;
+        bool seen = ((shard->doorkeeper[bit0 / 64] >> (bit0 % 64)) & 1) &&
+                    ((shard->doorkeeper[bit1 / 64] >> (bit1 % 64)) & 1);
+        if (!seen) {
+            // Start a new window once the bitset is about half full.
+            if (++shard->doorkeeper_inserts > bits / 4) {
+                std::fill(shard->doorkeeper.begin(), shard->doorkeeper.end(), 0);
+                shard->doorkeeper_inserts = 0;
+            }
+            shard->doorkeeper[bit0 / 64] |= 1ULL << (bit0 % 64);
+            shard->doorkeeper[bit1 / 64] |= 1ULL << (bit1 % 64);
+        }
+        return seen;
+    }
+
+    bool admission_filter_;
+    Shard shards_[kNumShards];
+    std::atomic<uint64_t> versions_[kVersionStripes];
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef META_TABLE_H
+#define META_TABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace LSM2LIX {
+
+// SST_ID of a file that was ingested directly, without an SSTable in the LSM-tree.
+const uint64_t kNoSSTID = UINT64_MAX;
+
+struct SSTableMeta {
+    uint64_t SST_ID; // The id assigned by LSM-tree
+    uint64_t cf_id;
+    uint64_t smallest_key;
+    uint64_t largest_key;
+    uint64_t flag;
+};
+
+// The metatable, indexed by transfer id. Transfer ids are handed out by a
+// monotonically increasing counter, so the entries are kept in a dense array
+// of lazily allocated chunks instead of a search tree: a lookup is a single
+// indexed load and needs no lock.
+//
+// Writers (Insert/Remove/Clear) must be serialized by the caller; Lookup and
+// the flag accessors may run concurrently with them.
+class MetaTable {
+    public:
+    MetaTable();
+    ~MetaTable();
+
+    MetaTable(const MetaTable&) = delete;
+    MetaTable& operator=(const MetaTable&) = delete;
+
+    // Returns false if id is beyond the capacity of the table, or already in
+    // it: an entry is never rewritten in place, so a lock-free Lookup always
+    // reads the fields of the entry it found valid.
+    bool Insert(uint64_t id, const SSTableMeta& meta);
+    void Remove(uint64_t id);
+    void Clear();
+
+    bool Lookup(uint64_t id, SSTableMeta* meta) const;
+    bool GetFlag(uint64_t id, uint64_t* flag) const;
+    void SetFlag(uint64_t id, uint64_t flag);
+    // Atomically replace the flag if it still equals expected.
+    bool CompareAndSetFlag(uint64_t id, uint64_t expected, uint64_t desired);
+    // How many entries of the file LIX still points at. Only an estimate to pick
+    // files to collect; total is 0 until known, e.g. after recovery.
+    void SetEntryCounts(uint64_t id, uint32_t live, uint32_t total);
+    bool GetEntryCounts(uint64_t id, uint32_t* live, uint32_t* total) const;
+    // Called when count entries of the file were superseded in LIX.
+    void DropLiveEntries(uint64_t id, uint32_t count);
+
+    bool Empty() const { return count_.load(std::memory_order_acquire) == 0; }
+    size_t Size() const { return count_.load(std::memory_order_acquire); }
+    // The largest transfer id ever inserted, 0 if none.
+    uint64_t MaxID() const { return max_id_.load(std::memory_order_acquire); }
+
+    // Call f(id, meta) for every entry in ascending id order.
+    template <class F>
+    void ForEach(F&& f) const {
+        SSTableMeta meta;
+        for (uint64_t id = 0; id <= MaxID(); id++) {
+            if (Lookup(id, &meta)) {
+                f(id, meta);
+            }
+        }
+    }
+
+    static const uint64_t kChunkBits = 12; // 4K entries per chunk
+    static const uint64_t kChunkSize = 1ULL << kChunkBits;
+    static const uint64_t kMaxChunks = 1ULL << 14; // 64M transfer ids
+
+    private:
+    struct Entry {
+        uint64_t SST_ID;
+        uint64_t smallest_key;
+        uint64_t largest_key;
+        uint32_t cf_id;
+        std::atomic<uint8_t> flag;
+        std::atomic<bool> valid;
+        std::atomic<uint32_t> live_entries;
+        std::atomic<uint32_t> total_entries;
+    };
+    static_assert(sizeof(Entry) == 40, "MetaTable entries should stay cache-line friendly");
+
+    Entry* Find(uint64_t id) const;
+
+    std::atomic<Entry*>* chunks_;
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> max_id_{0};
+};
+
+} // namespace
+
+#endif
@@ -91,6 +91,10 @@ class Iterator {
 
     // If an error has occurred, return it.  Else return an ok status.
     virtual Status status() const = 0;
+
+    // Position at the entry whose user key (the key without its 8-byte
+    // RocksDB sequence footer) is user_key, or as Seek(user_key) would.
+    virtual void SeekForGet(const Slice& user_key) { Seek(user_key); }
 };
 
 class Block {
@@ -101,15 +105,26 @@ class Block {
     ~Block() {};
     
     Iterator* NewIterator(const Comparator* comparator);
+    // Prefetches the memory step stage of SeekForGet(user_key) reads: 0 the
+    // hash bucket, or the middle of the restart array, 1 the restart entry the
+    // bucket names, or the entry in the middle, 2 that entry for the hash
+    // index. Running one stage for many keys before the next overlaps their
+    // cache misses.
+    void PrefetchForGet(const Slice& user_key, int stage) const;
 
     private:
     class Iter;
     
     uint32_t NumRestarts() const;
+    bool HasHashIndex() const;
 
     const char* data_;
     size_t size_;
     uint32_t restart_offset_;
+    // Buckets of the hash index of RocksDB's kDataBlockBinaryAndHash blocks,
+    // mapping a user key hash to the restart interval holding the key.
+    const char* hash_buckets_ = nullptr;
+    uint16_t num_buckets_ = 0;
 };
 
 // class Footer {
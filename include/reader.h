@@ -1,8 +1,12 @@
 #ifndef READER_H
 #define READER_H
 
+#include <memory>
+#include <string>
+
 #include "status.h"
 #include "read_datablock.h"
+#include "file_cache.h"
 
 namespace LSM2LIX {
 
@@ -13,14 +17,48 @@ class Reader {
     void AllocateBuf();
     void FreeBuf();
     void SetSSTFileName(std::string& filename);
+    // Check the crc32c of the block trailer on every read.
+    void SetVerifyChecksums(bool verify) { verify_checksums_ = verify; }
+    // Read 4KB-aligned blocks with O_DIRECT, in whole pages.
+    void SetDirectIO(bool direct_io) { direct_io_ = direct_io; }
+    // Read blocks from the mappings of file_cache instead of with pread.
+    void SetFileCache(FileCache* file_cache) { file_cache_ = file_cache; }
+    // Reads the block and its trailer, and decompresses the block if needed.
     Status ReadBlockContents(BlockHandle& handle);
+    // Asks the kernel to start reading the block in the background, so that
+    // a later ReadBlockContents() of it finds the pages in memory.
+    void Prefetch(const BlockHandle& handle);
+    // Serves the next Get()s from a block decompressed earlier.
+    void SetBlockContents(std::shared_ptr<const std::string> contents);
+    // The block last read, if it was compressed on disk; null otherwise.
+    std::shared_ptr<const std::string> DecompressedContents() const { return decompressed_; }
     void ReleaseBlockContents();
     Status Get(const Slice& key, std::string* value);
+    // Like Get(), but points *value into the block instead of copying it.
+    // *pin keeps that memory alive: the mapping, the decompressed block, or
+    // the read buffer, which the reader gives up until the next read.
+    Status GetPinned(const Slice& key, Slice* value, std::shared_ptr<const void>* pin);
+    // Prefetches one stage of the search GetPinned(key) runs in the block last read.
+    void PrefetchForGet(const Slice& key, int stage) const {
+        if (block_ != nullptr) {
+            block_->PrefetchForGet(key, stage);
+        }
+    }
 
     private:
+    Status ReadFromFile(const BlockHandle& handle, size_t length);
+    Status UncompressBlock(const char* data, size_t size, char type);
+
     std::string filename_;
     int fd_;
-    void* buf;
+    void* buf = nullptr;
+    size_t buf_size_ = 0;
+    bool verify_checksums_ = false;
+    bool direct_io_ = false;
+    FileCache* file_cache_ = nullptr;
+    std::shared_ptr<MappedFile> mapped_; // Pins the mapping the block points into
+    std::shared_ptr<const void> buf_pin_; // The buffer, once GetPinned() gave it up
+    std::shared_ptr<const std::string> decompressed_;
     Block* block_ = nullptr;
     Block* index_block_ = nullptr;
     const Comparator* comparator_ = nullptr;
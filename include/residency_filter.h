@@ -0,0 +1,52 @@
+#ifndef RESIDENCY_FILTER_H
+#define RESIDENCY_FILTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace LSM2LIX {
+
+// A blocked Bloom filter over key_num, answering whether a key may have a
+// version in an LSM-tree. All probes of a key hit one 64-bit word, so Add()
+// is a single atomic OR and MayContain() a single load.
+// The words are split into segments by key range, so that the keys of one
+// range can be dropped without rescanning the rest of the tree.
+class ResidencyFilter {
+    public:
+    explicit ResidencyFilter(size_t num_bytes);
+
+    ResidencyFilter(const ResidencyFilter&) = delete;
+    ResidencyFilter& operator=(const ResidencyFilter&) = delete;
+
+    void Add(uint64_t key_num);
+    bool MayContain(uint64_t key_num) const;
+    // Clears the filter and starts a segment at each of the sorted bounds.
+    // Not safe against concurrent Add().
+    void Reset(const std::vector<uint64_t>& bounds);
+    // Takes over the segments and bits of other. Not safe against concurrent Add().
+    void CopyFrom(const ResidencyFilter& other);
+    // Clears the segments overlapping [*smallest_key, *largest_key] and widens
+    // the range to all keys of those segments, which have to be added again.
+    // Not safe against concurrent Add().
+    void ClearRange(uint64_t* smallest_key, uint64_t* largest_key);
+
+    private:
+    static const int kProbes = 4;
+    static const size_t kMaxSegments = 64;
+
+    static uint64_t Mask(uint64_t hash);
+    size_t SegmentOf(uint64_t key_num) const;
+    std::atomic<uint64_t>& WordOf(uint64_t hash, size_t segment) const;
+
+    size_t num_words_;
+    std::unique_ptr<std::atomic<uint64_t>[]> words_;
+    // Segment i holds the keys in [bounds_[i - 1], bounds_[i]).
+    std::vector<uint64_t> bounds_;
+};
+
+} // namespace
+
+#endif
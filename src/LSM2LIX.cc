@@ -13,6 +13,8 @@
 #include <ctime>
 #include <cmath>
 
+#include "rocksdb/write_batch.h"
+
 #include "reader.h"
 #include "compact_files_to_LIX.h"
 #include "key_index.h"
@@ -24,9 +26,32 @@
 
 namespace LSM2LIX {
 
+static Status FromRocksDBStatus(const ROCKSDB_NAMESPACE::Status& s) {
+    if (s.ok()) {
+        return Status::OK();
+    } else if (s.IsNotFound()) {
+        return Status::NotFound(s.ToString());
+    } else if (s.IsCorruption()) {
+        return Status::Corruption(s.ToString());
+    } else if (s.IsNotSupported()) {
+        return Status::NotSupported(s.ToString());
+    } else if (s.IsInvalidArgument()) {
+        return Status::InvalidArgument(s.ToString());
+    }
+    return Status::IOError(s.ToString());
+}
+
 Status LSM2LIX::Open(std::string& DB_path, LSM2LIX** db_out) {
+    return Open(LSM2LIXOptions(), DB_path, db_out);
+}
+
+Status LSM2LIX::Open(const LSM2LIXOptions& options, std::string& DB_path, LSM2LIX** db_out) {
     Status status;
-    LSM2LIX* db = new LSM2LIX(DB_path);
+    if (options.num_partitions == 0 || options.lix_partitions == 0) {
+        return Status::InvalidArgument("Partition counts must be positive.");
+    }
+    LSM2LIX* db = new LSM2LIX(options, DB_path);
+    status = db->open_status_;
     if (status.ok()) {
         *db_out = db;
     } else {
@@ -35,7 +60,14 @@ Status LSM2LIX::Open(std::string& DB_path, LSM2LIX** db_out) {
     return status;
 }
 
-LSM2LIX::LSM2LIX(std::string& DB_path) {
+LSM2LIX::LSM2LIX(std::string& DB_path) : LSM2LIX(LSM2LIXOptions(), DB_path) {}
+
+LSM2LIX::LSM2LIX(const LSM2LIXOptions& lsm2lix_options, std::string& DB_path) {
+    lsm2lix_options_ = lsm2lix_options;
+    partition_cnt_ = lsm2lix_options.num_partitions; // Overwritten by the persisted value of an existing DB
+    lix_cnt_ = lsm2lix_options.lix_partitions;
+    handle_format_ = lsm2lix_options.handle_format;
+    inline_values_ = lsm2lix_options.inline_value_bytes > 0;
     DB_path_ = DB_path;
     LSM_path_ = DB_path + "/" + LSM_dir;
     LIX_path_ = DB_path + "/" + LIX_dir;
@@ -48,18 +80,79 @@ LSM2LIX::LSM2LIX(std::string& DB_path) {
         std::filesystem::create_directory(DB_path);
     }
 
-    RecoverStageI();
-    
+    open_status_ = RecoverStageI();
+    if (!open_status_.ok()) {
+        return;
+    }
+    if (partitioner_.NumPartitions() != partition_cnt_) { // No split points persisted
+        partitioner_.Init(partition_cnt_);
+    }
+
     // Init TreeLine
     tl::pg::PageGroupedDBOptions tloptions;
     tloptions.use_memory_based_io = false;
-    tloptions.bypass_cache = true;
+    tloptions.bypass_cache = (lsm2lix_options_.lix_cache_records == 0);
+    if (!tloptions.bypass_cache) {
+        tloptions.record_cache_capacity = lsm2lix_options_.lix_cache_records;
+    }
     tloptions.use_pgm_builder = true;
     tloptions.forecasting.use_insert_forecasting = false;
     tloptions.disable_overflow_creation = true;
     tloptions.num_bg_threads = 0;
     tl::pg::PageGroupedDBStats::RunOnGlobal([](auto& global_stats) { global_stats.Reset(); });
-    tl::Status tls = tl::pg::PageGroupedDB::Open(tloptions, LIX_path_, &tldb_);
+    // A single instance lives directly in LIX_path_, as in DBs created before partitioning.
+    if (lix_cnt_ > 1) {
+        std::filesystem::create_directory(LIX_path_);
+    }
+    tldbs_.resize(lix_cnt_, nullptr);
+    bulkload_.resize(lix_cnt_, false);
+    for (uint32_t i = 0; i < lix_cnt_; i++) {
+        std::string lix_path = lix_cnt_ > 1 ? LIX_path_ + "/" + std::to_string(i) : LIX_path_;
+        bulkload_[i] = !std::filesystem::exists(lix_path);
+        tl::Status tls = tl::pg::PageGroupedDB::Open(tloptions, lix_path, &tldbs_[i]);
+        if (!tls.ok()) {
+            open_status_ = Status::IOError("Learned index can not be opened.");
+            return;
+        }
+    }
+
+    if (lsm2lix_options_.handle_cache_bytes > 0) {
+        handle_cache_ = new HandleCache(lsm2lix_options_.handle_cache_bytes);
+    }
+    if (lsm2lix_options_.residency_filter_bytes > 0) {
+        for (uint32_t i = 0; i < partition_cnt_; i++) {
+            residency_filters_.emplace_back(new ResidencyFilter(lsm2lix_options_.residency_filter_bytes));
+            residency_filters_.emplace_back(new ResidencyFilter(lsm2lix_options_.residency_filter_bytes));
+        }
+        residency_scheduled_.assign(partition_cnt_, false);
+        residency_full_.assign(partition_cnt_, false);
+        residency_ranges_.resize(partition_cnt_);
+        residency_active_.assign(partition_cnt_, 0);
+        residency_rebuilding_.assign(partition_cnt_, false);
+        residency_ready_.assign(partition_cnt_, false); // Until the first rebuild has seen the whole tree
+    }
+    if (lsm2lix_options_.row_cache_bytes > 0) {
+        row_cache_ = new LRUCache<std::string>(lsm2lix_options_.row_cache_bytes, lsm2lix_options_.row_cache_admission_filter);
+    }
+    if (lsm2lix_options_.decompressed_block_cache_bytes > 0) {
+        block_cache_ = new LRUCache<std::shared_ptr<const std::string>>(lsm2lix_options_.decompressed_block_cache_bytes, false);
+    }
+    if (lsm2lix_options_.max_mapped_files > 0) {
+        file_cache_ = new FileCache(lsm2lix_options_.max_mapped_files,
+                                    lsm2lix_options_.mmap_random_access ? MappedFile::kRandom : MappedFile::kSequential);
+    }
+    if (lsm2lix_options_.hotness_aware_transfer) {
+        hotness_ = new HotnessTracker(partition_cnt_, lsm2lix_options_.hotness_sample_interval);
+    }
+    if (lsm2lix_options_.promotion_threshold > 0) {
+        promotion_sketch_ = new FrequencySketch(lsm2lix_options_.promotion_sketch_bytes);
+        writes_started_.reset(new std::atomic<uint64_t>[kWriteStripes]);
+        writes_done_.reset(new std::atomic<uint64_t>[kWriteStripes]);
+        for (size_t i = 0; i < kWriteStripes; i++) {
+            writes_started_[i].store(0);
+            writes_done_[i].store(0);
+        }
+    }
 
     // Init LSM-forest
     // TODO: disable compaction job
@@ -69,8 +162,22 @@ LSM2LIX::LSM2LIX(std::string& DB_path) {
     coptions.num_levels = 1;
     coptions.target_file_size_base = 64 << 20;
     coptions.write_buffer_size = 64 << 20;
+    coptions.compression = lsm2lix_options_.sst_compression;
+    coptions.bottommost_compression = lsm2lix_options_.sst_compression;
     BlockBasedTableOptions table_options;
     table_options.block_size_deviation = 50;
+    // Block trailers carry a plain crc32c, as Reader verifies them.
+    table_options.checksum = ROCKSDB_NAMESPACE::kCRC32c;
+    table_options.format_version = 5;
+    // Data blocks get a hash index of their keys, which Reader probes before the restart array.
+    table_options.data_block_index_type = BlockBasedTableOptions::kDataBlockBinaryAndHash;
+    // Packed handles address blocks in 4KB units.
+    if (handle_format_ == kPackedHandles || lsm2lix_options_.align_data_blocks) {
+        table_options.block_size = 4096;
+        table_options.block_align = true;
+        coptions.compression = ROCKSDB_NAMESPACE::kNoCompression; // RocksDB can not align compressed blocks
+        coptions.bottommost_compression = ROCKSDB_NAMESPACE::kNoCompression;
+    }
     table_options.filter_policy.reset(ROCKSDB_NAMESPACE::NewBloomFilterPolicy(10));
     coptions.table_factory.reset(NewBlockBasedTableFactory(table_options));
     DBOptions doptions;
@@ -83,19 +190,25 @@ LSM2LIX::LSM2LIX(std::string& DB_path) {
     options_ = options;
     float full_pec = 0.9;
     uint64_t threshold = full_pec * options.max_bytes_for_level_base * pow(static_cast<int>(options.max_bytes_for_level_multiplier), (options.num_levels - 1));
-    uint64_t SST_NUM = TransID2SSTMeta_.empty() ? 0 : TransID2SSTMeta_.rbegin()->first;
-    options.listeners.emplace_back(new LSM2LIX_Mover(coptions.num_levels, threshold, options, this, SST_NUM)); // By defalut, the last item in the std::map has the largest key.
+    // Continue after the largest transfer id ever logged, even if GC removed it since.
+    if (!TransID2SSTMeta_.Empty() && TransID2SSTMeta_.MaxID() >= next_trans_id_.load()) {
+        next_trans_id_.store(TransID2SSTMeta_.MaxID() + 1);
+    }
+    options.listeners.emplace_back(new LSM2LIX_Mover(coptions.num_levels, threshold, options, this));
 
+    // Partition i is served by handles_[i], so the default column family holds partition 0.
     std::vector<ColumnFamilyDescriptor> column_families;
     column_families.push_back(ColumnFamilyDescriptor(ROCKSDB_NAMESPACE::kDefaultColumnFamilyName, coptions));
-    for (int i = 0; i < ColumnFamilyCnt; i++) {
+    for (uint32_t i = 0; i < partition_cnt_; i++) {
         column_families.push_back(ColumnFamilyDescriptor("cf" + std::to_string(i), coptions));
     }
     ROCKSDB_NAMESPACE::Status s = DB::Open(options, LSM_path_, column_families, &handles_, &db_);
+    if (!s.ok()) { // E.g. the persisted partition count does not match the column families on disk
+        db_ = nullptr;
+        open_status_ = FromRocksDBStatus(s);
+        return;
+    }
 
-    if (!std::filesystem::exists(LIX_path_)) {
-        bulkload_ = true;
-    } 
     // else {
     //     {
     //         std::ifstream ifs("/tmp/LSM2LIX/TransFile_dir_.ser");
@@ -115,13 +228,40 @@ LSM2LIX::LSM2LIX(std::string& DB_path) {
     // }
 
     // datablock_reader_.AllocateBuf();
-    RecoverStageII();
+    open_status_ = RecoverStageII();
+    if (!open_status_.ok()) {
+        return;
+    }
+    bg_pool_ = new ThreadPool(1);
+    if (lsm2lix_options_.speculative_lix_reads && lsm2lix_options_.speculative_threads > 0) {
+        spec_pool_ = new ThreadPool(lsm2lix_options_.speculative_threads);
+    }
+    for (uint32_t i = 0; !residency_filters_.empty() && i < partition_cnt_; i++) {
+        ScheduleResidencyRebuild(i);
+    }
+    if (partitioner_.Migrating()) { // Resume the interrupted rebalance
+        rebalance_scheduled_.store(true);
+        bg_pool_->Schedule([this] {
+            Rebalance();
+            rebalance_scheduled_.store(false);
+        });
+    }
     //db_->SetOptions({{"disable_auto_compactions", "false"}}); // enable the auto compaction
 }
 
 LSM2LIX::~LSM2LIX(){
+    delete bg_pool_; // Finish the background work before closing the trees
+    delete spec_pool_;
     delete db_;
-    delete tldb_;
+    for (auto tldb : tldbs_) {
+        delete tldb;
+    }
+    delete handle_cache_;
+    delete row_cache_;
+    delete block_cache_;
+    delete file_cache_;
+    delete hotness_;
+    delete promotion_sketch_;
     delete mLogWriter_;
     ::close(mlog_fd_);
     // {
@@ -142,299 +282,1203 @@ LSM2LIX::~LSM2LIX(){
 }
 
 Status LSM2LIX::Put(const ROCKSDB_NAMESPACE::Slice& key, const ROCKSDB_NAMESPACE::Slice& value) {
-    Status status;
-    uint64_t key_num = KeyIndex::ExtractHead64(key);
-    uint32_t handle_num = DispatchRequest(key_num, ColumnFamilyCnt);
-    ROCKSDB_NAMESPACE::Status s = db_->Put(wopts_, handles_[handle_num] ,key, value);
-    return status;
+    return PutImpl(KeyIndex::ExtractHead64(key), key, value);
 }
 
-Status LSM2LIX::Get(const ROCKSDB_NAMESPACE::Slice& key, std::string* value) {
-#ifdef TIMING
-    using std::chrono::high_resolution_clock;
-    using std::chrono::duration_cast;
-    using std::chrono::duration;
-    using std::chrono::microseconds;
+Status LSM2LIX::Put(uint64_t key, const ROCKSDB_NAMESPACE::Slice& value) {
+    KeyIndex::IntKeyAsSlice key_slice(key);
+    return PutImpl(key, key_slice.as<ROCKSDB_NAMESPACE::Slice>(), value);
+}
 
-    std::chrono::microseconds us_lsm, us_lix, us_block0, us_block1, us_get;
-#endif
+Status LSM2LIX::PutImpl(uint64_t key_num, const ROCKSDB_NAMESPACE::Slice& key, const ROCKSDB_NAMESPACE::Slice& value) {
+    ROCKSDB_NAMESPACE::WriteBatch batch;
+    ROCKSDB_NAMESPACE::Status s;
+    {
+    std::shared_lock<std::shared_mutex> lock(dispatch_mutex_);
+    DispatchPut(key_num, key, value, &batch);
+    if (row_cache_ != nullptr) { // Rejects the fills of Gets that read the old value
+        row_cache_->Erase(key.ToString());
+    }
+    s = db_->Write(wopts_, &batch);
+    }
+    FinishDispatch(&key_num, 1);
+    if (row_cache_ != nullptr) { // And of those that read it while the write was in flight
+        row_cache_->Erase(key.ToString());
+    }
+    if (lsm2lix_options_.adaptive_partitioning &&
+        partitioner_.Sample(key_num, lsm2lix_options_.partition_sample_interval)) {
+        MaybeScheduleRebalance();
+    }
+    return FromRocksDBStatus(s);
+}
+
+// Re-dispatches the puts of a user batch to the column families owning their keys.
+class LSM2LIX::BatchDispatcher : public ROCKSDB_NAMESPACE::WriteBatch::Handler {
+    public:
+    BatchDispatcher(LSM2LIX* db, ROCKSDB_NAMESPACE::WriteBatch* batch) : db_(db), batch_(batch) {}
+
+    ROCKSDB_NAMESPACE::Status PutCF(uint32_t /*column_family_id*/, const ROCKSDB_NAMESPACE::Slice& key,
+                                    const ROCKSDB_NAMESPACE::Slice& value) override {
+        uint64_t key_num = KeyIndex::ExtractHead64(key);
+        db_->DispatchPut(key_num, key, value, batch_);
+        keys_.push_back(key.ToString());
+        key_nums_.push_back(key_num);
+        return ROCKSDB_NAMESPACE::Status::OK();
+    }
+    // LIX has no tombstones, so a delete could not hide the copy a key has there.
+    ROCKSDB_NAMESPACE::Status DeleteCF(uint32_t, const ROCKSDB_NAMESPACE::Slice&) override {
+        return ROCKSDB_NAMESPACE::Status::NotSupported("Only puts can be written to LSM2LIX.");
+    }
+    ROCKSDB_NAMESPACE::Status SingleDeleteCF(uint32_t, const ROCKSDB_NAMESPACE::Slice&) override {
+        return ROCKSDB_NAMESPACE::Status::NotSupported("Only puts can be written to LSM2LIX.");
+    }
+    ROCKSDB_NAMESPACE::Status DeleteRangeCF(uint32_t, const ROCKSDB_NAMESPACE::Slice&, const ROCKSDB_NAMESPACE::Slice&) override {
+        return ROCKSDB_NAMESPACE::Status::NotSupported("Only puts can be written to LSM2LIX.");
+    }
+    ROCKSDB_NAMESPACE::Status MergeCF(uint32_t, const ROCKSDB_NAMESPACE::Slice&, const ROCKSDB_NAMESPACE::Slice&) override {
+        return ROCKSDB_NAMESPACE::Status::NotSupported("Only puts can be written to LSM2LIX.");
+    }
+
+    const std::vector<std::string>& keys() const { return keys_; }
+    const std::vector<uint64_t>& key_nums() const { return key_nums_; }
+
+    private:
+    LSM2LIX* db_;
+    ROCKSDB_NAMESPACE::WriteBatch* batch_;
+    std::vector<std::string> keys_;
+    std::vector<uint64_t> key_nums_;
+};
+
+Status LSM2LIX::Write(ROCKSDB_NAMESPACE::WriteBatch* updates) {
+    ROCKSDB_NAMESPACE::WriteBatch batch;
+    BatchDispatcher dispatcher(this, &batch);
+    ROCKSDB_NAMESPACE::Status s;
+    {
+    std::shared_lock<std::shared_mutex> lock(dispatch_mutex_);
+    s = updates->Iterate(&dispatcher);
+    for (size_t i = 0; s.ok() && row_cache_ != nullptr && i < dispatcher.keys().size(); i++) {
+        row_cache_->Erase(dispatcher.keys()[i]); // As in PutImpl, on both sides of the write
+    }
+    if (s.ok()) { // One WAL append covers every column family, and the batch applies atomically.
+        s = db_->Write(wopts_, &batch);
+    }
+    }
+    FinishDispatch(dispatcher.key_nums().data(), dispatcher.key_nums().size());
+    if (!s.ok()) {
+        return FromRocksDBStatus(s);
+    }
+    for (size_t i = 0; row_cache_ != nullptr && i < dispatcher.keys().size(); i++) {
+        row_cache_->Erase(dispatcher.keys()[i]);
+    }
+    bool rebalance = false;
+    for (size_t i = 0; lsm2lix_options_.adaptive_partitioning && i < dispatcher.key_nums().size(); i++) {
+        rebalance |= partitioner_.Sample(dispatcher.key_nums()[i], lsm2lix_options_.partition_sample_interval);
+    }
+    if (rebalance) {
+        MaybeScheduleRebalance();
+    }
+    return Status::OK();
+}
+
+Status LSM2LIX::IngestSorted(ROCKSDB_NAMESPACE::Iterator* iter) {
     Status status;
-    uint64_t key_num = KeyIndex::ExtractHead64(key);
-    uint32_t handle_num = DispatchRequest(key_num, ColumnFamilyCnt);
-#ifdef TIMING
-    auto t0 = high_resolution_clock::now();
-#endif
-    ROCKSDB_NAMESPACE::Status s = db_->Get(ropts_, handles_[handle_num], key, value);
-#ifdef TIMING
-    auto t1 = high_resolution_clock::now();
-    us_lsm = duration_cast<microseconds>(t1 - t0);
-#endif
-    if (s.IsNotFound()) {
-        std::string offset_value;
-        uint64_t filenum, offset, size;
-        std::string filename, filename_old;
-#ifdef TIMING
-        auto t2 = high_resolution_clock::now();
-#endif
-        tl::Status tls = tldb_->Get(key_num, &offset_value);
-#ifdef TIMING
-        auto t3 = high_resolution_clock::now();
-        us_lix = duration_cast<microseconds>(t3 - t2);
-#endif
-        if (tls.IsNotFound()) {
-            return Status::NotFound("Key is not found.");
-        }
-        KeyIndex::OffsetToBlockHandle(const_cast<char*>(offset_value.c_str()), &filenum, &offset, &size);
-        BlockHandle handle = {.offset_ = offset, .size_ = size};
-        Reader datablock_reader;
-        datablock_reader.AllocateBuf();
-        bool read = false;
-        {// lock phase TODO; This lock is tooooo heavy, it should be replaced.
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        // Find Sst id.
-        auto it = TransID2SSTMeta_.find(filenum);
-        if (it->second.flag == Detaching) {
-            filename_old = MakeTableFileName(LSM_path_, it->second.SST_ID);
-            datablock_reader.SetSSTFileName(filename_old);
-#ifdef TIMING
-            auto t4 = high_resolution_clock::now();
-#endif
-            status = datablock_reader.ReadBlockContents(handle);
-#ifdef TIMING
-            auto t5 = high_resolution_clock::now();
-            us_block0 = duration_cast<microseconds>(t5 - t4);
-#endif
-            if (status.IsNotFound()) { // Old SST file name is out-of-date.
-                it->second.flag = Normal;
-                // Add a record in the mLog
-                char record_buf[60];
-                uint64_t offset = 0;
-                uint64_t record_type = modify;
-                EncodeFixed64(record_buf + offset, record_type);
-                offset += sizeof(uint64_t);
-                EncodeFixed64(record_buf + offset, filenum);
-                offset += sizeof(uint64_t);
-                EncodeFixed64(record_buf + offset, Normal);
-                offset += sizeof(uint64_t);
-                mLogWriter_->AddRecord(Slice(record_buf, offset)); 
-            } else {
-                read = true;
-            }
+    ROCKSDB_NAMESPACE::Status s;
+    std::unique_ptr<SstFileWriter> writer;
+    // Pairs not yet loaded into each LIX instance, flushed every kIngestChunk records.
+    std::vector<std::vector<tl::pg::Record>> runs(lix_cnt_);
+    std::vector<std::vector<std::unique_ptr<char[]>>> offset_values(lix_cnt_); // Backs the values of runs
+    std::vector<std::vector<std::string>> keys(lix_cnt_); // Row cache entries to drop once the pairs are indexed
+    uint64_t file_id = 0;
+    uint64_t smallest_key = 0, last_key = 0;
+    uint32_t partition_num = 0, lix_num = 0;
+    bool first = true;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        uint64_t key_num = KeyIndex::ExtractHead64(iter->key());
+        if (!first && key_num <= last_key) {
+            status = Status::InvalidArgument("Ingested keys must be strictly increasing.");
+            break;
         }
-        } // end of lock phase
-        if (!read) {
-            filename = MakeTransFileName(LSM_path_, filenum);
-            datablock_reader.SetSSTFileName(filename);
-#ifdef TIMING
-            auto t6 = high_resolution_clock::now();
-#endif
-            status = datablock_reader.ReadBlockContents(handle);
-#ifdef TIMING
-            auto t7 = high_resolution_clock::now();
-            us_block1 = duration_cast<microseconds>(t7 - t6);
-#endif
+        uint32_t key_partition;
+        {
+        std::shared_lock<std::shared_mutex> lock(dispatch_mutex_);
+        key_partition = partitioner_.Route(key_num);
         }
-        if (!status.ok()) {
-            status = Status::IOError("Data block can not be read.");
-        } else {
-#ifdef TIMING
-            auto t8 = high_resolution_clock::now();
-#endif
-            status = datablock_reader.Get(key.data(), value);
-#ifdef TIMING
-            auto t9 = high_resolution_clock::now();
-            us_get = duration_cast<microseconds>(t9 - t8);
-#endif
+        // A file never spans two partitions or two LIX instances.
+        if (writer != nullptr && (key_partition != partition_num || LIXOf(key_num) != lix_num ||
+                                  writer->FileSize() >= options_.target_file_size_base)) {
+            status = FinishIngestFile(writer.get(), file_id, partition_num, smallest_key, last_key, &runs[lix_num], &offset_values[lix_num]);
+            writer.reset();
+            if (status.ok() && runs[lix_num].size() >= kIngestChunk) {
+                status = FlushIngestRun(lix_num, &runs[lix_num], &offset_values[lix_num], &keys[lix_num]);
+            }
             if (!status.ok()) {
-                status = Status::NotFound("Key is not found in data block.");
+                break;
             }
         }
-        datablock_reader.FreeBuf();
+        if (writer == nullptr) {
+            file_id = NewTransID();
+            writer.reset(new SstFileWriter(EnvOptions(), options_));
+            s = writer->Open(MakeTransFileName(LSM_path_, file_id));
+            if (!s.ok()) {
+                status = FromRocksDBStatus(s);
+                break;
+            }
+            partition_num = key_partition;
+            lix_num = LIXOf(key_num);
+            smallest_key = key_num;
+        }
+        s = writer->Put(iter->key(), iter->value());
+        if (!s.ok()) {
+            status = FromRocksDBStatus(s);
+            break;
+        }
+        if (row_cache_ != nullptr) {
+            keys[lix_num].push_back(iter->key().ToString());
+        }
+        last_key = key_num;
+        first = false;
+    }
+    if (status.ok() && !iter->status().ok()) {
+        status = FromRocksDBStatus(iter->status());
+    }
+    if (writer != nullptr) {
+        if (status.ok()) {
+            status = FinishIngestFile(writer.get(), file_id, partition_num, smallest_key, last_key, &runs[lix_num], &offset_values[lix_num]);
+        } else { // The file is not registered yet, so nothing refers to it.
+            writer.reset();
+            std::filesystem::remove(MakeTransFileName(LSM_path_, file_id));
+        }
+    }
+    // The files finished before an error are registered, so they are indexed anyway.
+    for (uint32_t i = 0; i < lix_cnt_; i++) {
+        Status flushed = FlushIngestRun(i, &runs[i], &offset_values[i], &keys[i]);
+        if (status.ok()) {
+            status = flushed;
+        }
     }
     return status;
 }
 
-Status LSM2LIX::BatchUpdate_LIX(std::vector<tl::pg::Record>& pairs, uint64_t old_id, uint64_t new_id, uint32_t cf_id, bool redo){
-    // Todo: RW-Lock
-    Status status;
+Status LSM2LIX::FlushIngestRun(uint32_t lix_num, std::vector<tl::pg::Record>* run,
+                               std::vector<std::unique_ptr<char[]>>* offset_values, std::vector<std::string>* keys) {
+    if (run->empty()) {
+        return Status::OK();
+    }
     tl::Status tls;
-
-    char record_buf[60];
-    uint64_t offset = 0;
+    {
+    std::shared_lock<std::shared_mutex> remap_lock(lix_remap_mutex_);
+    bool bulkload = false;
     { // lock phase
     std::unique_lock<std::shared_mutex> lock(mutex_);
-    if (!redo) {
-        SSTableMeta stm = {.SST_ID = old_id, .cf_id = cf_id, .smallest_key = pairs.front().first, .largest_key = pairs.back().first, .flag = Transfering};
-        TransID2SSTMeta_.emplace(new_id, stm);
-        // Add a record in the mLog
-        uint64_t record_type = insert;
-        EncodeFixed64(record_buf + offset, record_type);
-        offset += sizeof(uint64_t);
-        EncodeFixed64(record_buf + offset, new_id);
-        offset += sizeof(uint64_t);
-        EncodeFixed64(record_buf + offset, old_id);
-        offset += sizeof(uint64_t);
-        EncodeFixed64(record_buf + offset, cf_id);
-        offset += sizeof(uint64_t);
-        uint64_t smallest_key = pairs.front().first;
-        EncodeFixed64(record_buf + offset, smallest_key);
-        offset += sizeof(uint64_t);
-        uint64_t largest_key = pairs.back().first;
-        EncodeFixed64(record_buf + offset, largest_key);
-        offset += sizeof(uint64_t);
-        EncodeFixed64(record_buf + offset, static_cast<uint64_t>(Transfering));
-        offset += sizeof(uint64_t);
-        mLogWriter_->AddRecord(Slice(record_buf, offset));
+    if (bulkload_[lix_num]) { // Only the first chunk of an empty instance is bulk loaded
+        bulkload = true;
+        tls = tldbs_[lix_num]->BulkLoad(*run);
+        bulkload_[lix_num] = false;
     }
-    if (bulkload_) {
-        tls = tldb_->BulkLoad(pairs);
-        bulkload_ = false;
-        if (!tls.ok()) {
-            status = Status::IOError("Batch Load Failed.");
-        }
-        return status;
+    } // lock phase
+    if (!bulkload) {
+        tls = tldbs_[lix_num]->PutBatch(*run);
     }
-    } // lock phase 
-    tls = tldb_->PutBatch(pairs);
-    if (!tls.ok()) {
-        status = Status::IOError("Batch Load Failed.");
+    for (size_t j = 0; handle_cache_ != nullptr && j < run->size(); j++) {
+        handle_cache_->Erase((*run)[j].first);
+    }
+    lix_epoch_++; // A rewrite that copied these keys rechecks them
+    }
+    for (size_t j = 0; row_cache_ != nullptr && j < keys->size(); j++) {
+        row_cache_->Erase((*keys)[j]);
+    }
+    run->clear();
+    offset_values->clear();
+    keys->clear();
+    return tls.ok() ? Status::OK() : Status::IOError("Batch Load Failed.");
+}
+
+Status LSM2LIX::FinishIngestFile(SstFileWriter* writer, uint64_t file_id, uint32_t partition_num, uint64_t smallest_key,
+                                 uint64_t largest_key, std::vector<tl::pg::Record>* run,
+                                 std::vector<std::unique_ptr<char[]>>* offset_values) {
+    std::string filename = MakeTransFileName(LSM_path_, file_id);
+    ROCKSDB_NAMESPACE::Status s = writer->Finish();
+    if (!s.ok()) {
+        std::filesystem::remove(filename);
+        return FromRocksDBStatus(s);
+    }
+    // The block handles are only known once the table is finished, so they are read back from it.
+    std::vector<tl::pg::Record> pairs;
+    std::unique_ptr<char[]> values(LSM2LIX_Mover::GetTreeLineIndexPair(filename, file_id, options_, ropts_, GetValueEncoding(), &pairs));
+    if (values == nullptr) {
+        std::filesystem::remove(filename);
+        return Status::InvalidArgument("Block handles do not fit the handle format.");
     }
     { // lock phase
+    // Registered before it is indexed, so the id is never handed out again after a crash.
     std::unique_lock<std::shared_mutex> lock(mutex_);
-    auto it = TransID2SSTMeta_.find(new_id);
-    it->second.flag = Detaching;
+    SSTableMeta stm = {.SST_ID = kNoSSTID, .cf_id = handles_[partition_num]->GetID(), .smallest_key = smallest_key, .largest_key = largest_key, .flag = Normal};
+    if (!TransID2SSTMeta_.Insert(file_id, stm)) { // Nothing refers to the file yet
+        std::filesystem::remove(filename);
+        return Status::NotSupported("Transfer id beyond the capacity of the metatable.");
+    }
+    TransID2SSTMeta_.SetEntryCounts(file_id, pairs.size(), pairs.size());
     // Add a record in the mLog
+    char record_buf[60];
     uint64_t offset = 0;
-    uint64_t record_type = modify;
+    uint64_t record_type = insert;
     EncodeFixed64(record_buf + offset, record_type);
     offset += sizeof(uint64_t);
-    EncodeFixed64(record_buf + offset, new_id);
+    EncodeFixed64(record_buf + offset, file_id);
     offset += sizeof(uint64_t);
-    EncodeFixed64(record_buf + offset, Detaching);
+    EncodeFixed64(record_buf + offset, stm.SST_ID);
+    offset += sizeof(uint64_t);
+    EncodeFixed64(record_buf + offset, stm.cf_id);
+    offset += sizeof(uint64_t);
+    EncodeFixed64(record_buf + offset, smallest_key);
+    offset += sizeof(uint64_t);
+    EncodeFixed64(record_buf + offset, largest_key);
+    offset += sizeof(uint64_t);
+    EncodeFixed64(record_buf + offset, static_cast<uint64_t>(Normal));
     offset += sizeof(uint64_t);
     mLogWriter_->AddRecord(Slice(record_buf, offset));
     } // lock phase
-    return status;
+    run->insert(run->end(), pairs.begin(), pairs.end());
+    offset_values->push_back(std::move(values));
+    return Status::OK();
 }
 
-void LSM2LIX::Set_mLogWriter(LOG::LOG_Writer* mLogWriter) {
-    mLogWriter_ = mLogWriter;
+void LSM2LIX::DispatchPut(uint64_t key_num, const ROCKSDB_NAMESPACE::Slice& key,
+                          const ROCKSDB_NAMESPACE::Slice& value, ROCKSDB_NAMESPACE::WriteBatch* batch, bool promotion) {
+    if (!promotion && writes_started_ != nullptr) {
+        // Stamped before promoting_ is read: a promotion either sees the stamp and
+        // drops the key, or checked before it and this write waits for its write.
+        writes_started_[WriteStripe(key_num)].fetch_add(1);
+        if (promoting_.load()) {
+            std::unique_lock<std::mutex> lock(promote_mutex_);
+        }
+    }
+    uint32_t handle_num = partitioner_.Route(key_num);
+    // Mark the key before it becomes visible in the tree.
+    NoteResidency(handle_num, key_num);
+    if (hotness_ != nullptr) {
+        hotness_->RecordWrite(handle_num, key_num);
+    }
+    batch->Put(handles_[handle_num], key, value);
+    if (partitioner_.Migrating() && partitioner_.RoutePrevious(key_num) != handle_num) {
+        // Drop the copy in the former owner, and keep the migration from copying
+        // it over this write, which it may have read before.
+        batch->Delete(handles_[partitioner_.RoutePrevious(key_num)], key);
+        std::unique_lock<std::mutex> lock(migrate_mutex_);
+        if (key.compare(ROCKSDB_NAMESPACE::Slice(migrate_done_below_)) >= 0) { // Not migrated yet
+            migrate_dirty_.insert(key.ToString());
+        }
+    }
 }
 
-Status LSM2LIX::RecoverStageI() {
-    Status status;
-    std::vector<std::string> mLOG_list, tLOG_list;
-    // First, we recover the table from the mLOG
-    status = RecovermLogFile();
-    // ExtractTodoList(&todolist_);
-    // status = RecovertLogFile(&todolist_);
-
-    detachlist_.clear();
-    todolist_.clear();
-    std::map<uint64_t, SSTableMeta>::iterator it;
-    for (it = TransID2SSTMeta_.begin(); it != TransID2SSTMeta_.end(); it++) {
-        if (it->second.flag == Detaching) { // Manually rename to prevent the LSM-tree deleting the old SSTable file
-            std::string old_name = MakeTableFileName(LSM_path_, it->second.SST_ID);
-            std::string new_name = MakeTransFileName(LSM_path_, it->first);
-            if (std::rename(old_name.c_str(), new_name.c_str()) == 0) { // The SSTable has not been renamed before recovery
-                detachlist_.emplace_back(it->first);
-            }
-        } else if (it->second.flag == Transfering) {
-            todolist_.emplace_back(it->first);
-        }
+// Copies a pinned value out, as DB::Get does.
+static Status CopyPinned(Status status, const ROCKSDB_NAMESPACE::PinnableSlice& pinnable, std::string* value) {
+    if (status.ok() && pinnable.IsPinned()) {
+        value->assign(pinnable.data(), pinnable.size());
     }
     return status;
 }
 
-Status LSM2LIX::RecoverStageII() {
-    Status status;
+Status LSM2LIX::Get(const ROCKSDB_NAMESPACE::Slice& key, std::string* value) {
+    ROCKSDB_NAMESPACE::PinnableSlice pinnable(value);
+    return CopyPinned(GetImpl(KeyIndex::ExtractHead64(key), key, &pinnable), pinnable, value);
+}
 
-    // Rewrite the mLog
-    time_t now;
-    time(&now);
-    tm info;
-    char time_stamp[80];
-    localtime_r(&now, &info);
-    strftime(time_stamp, 80, "%Y-%m-%d-%H:%M:%S", &info);
-    std::string mlog_path = DB_path_ + "/" + time_stamp + "." + mLOG_suffix;
-    mlog_fd_ = ::open(mlog_path.c_str(), O_CREAT | O_RDWR);
-    mLogWriter_ = new LOG::LOG_Writer(mlog_fd_, mlog_path);
-    char record_buf[60];
-    uint64_t offset = 0;
-    std::map<uint64_t, SSTableMeta>::iterator it;
-    for (it = TransID2SSTMeta_.begin(); it != TransID2SSTMeta_.end(); it++) {
-        uint64_t record_type = insert;
-        EncodeFixed64(record_buf + offset, record_type);
-        offset += sizeof(uint64_t);
-        uint64_t SST_NUM = it->first;
-        EncodeFixed64(record_buf + offset, SST_NUM);
-        offset += sizeof(uint64_t);
-        uint64_t SST_ID = it->second.SST_ID;
-        EncodeFixed64(record_buf + offset, SST_ID);
-        offset += sizeof(uint64_t);
-        uint64_t cf_id = it->second.cf_id;
-        EncodeFixed64(record_buf + offset, cf_id);
-        offset += sizeof(uint64_t);
-        uint64_t smallest_key = it->second.smallest_key;
-        EncodeFixed64(record_buf + offset, smallest_key);
-        offset += sizeof(uint64_t);
-        uint64_t largest_key = it->second.largest_key;
-        EncodeFixed64(record_buf + offset, largest_key);
-        offset += sizeof(uint64_t);
-        uint64_t flag = it->second.flag;
-        EncodeFixed64(record_buf + offset, flag);
-        offset += sizeof(uint64_t);
-        status = mLogWriter_->AddRecord(Slice(record_buf, offset));
-    }
-    //TODO: the stale mLog file can be removed at here
+Status LSM2LIX::Get(uint64_t key, std::string* value) {
+    KeyIndex::IntKeyAsSlice key_slice(key);
+    ROCKSDB_NAMESPACE::PinnableSlice pinnable(value);
+    return CopyPinned(GetImpl(key, key_slice.as<ROCKSDB_NAMESPACE::Slice>(), &pinnable), pinnable, value);
+}
 
-    // Replay the todolist
-    for (uint64_t SST_NUM : todolist_) {
-        std::map<uint64_t, SSTableMeta>::iterator it = TransID2SSTMeta_.find(SST_NUM);
-        uint32_t cf_id = static_cast<uint32_t>(it->second.cf_id);
-        uint64_t old_id = it->second.SST_ID;
-        uint64_t total_size = 0;
-        std::string old_name, old_path;
-        db_->SelectTransFile(0, &total_size, cf_id, &old_id, &old_name, &old_path, SST_NUM, /*force*/true);
-        std::string filename = MakeTableFileName(old_path, old_id);
-        std::vector<tl::pg::Record> pairs;
-        char* offset_values = LSM2LIX_Mover::GetTreeLineIndexPair(filename, SST_NUM, options_, ropts_, &pairs);
-        BatchUpdate_LIX(pairs, old_id, SST_NUM, cf_id, /*redo*/true);
-        detachlist_.emplace_back(SST_NUM);
-        delete offset_values;
-    }
+Status LSM2LIX::Get(const ROCKSDB_NAMESPACE::Slice& key, ROCKSDB_NAMESPACE::PinnableSlice* value) {
+    return GetImpl(KeyIndex::ExtractHead64(key), key, value);
+}
 
-    // Replay the detachlist
-    for (uint64_t SST_NUM : detachlist_) {
-        std::map<uint64_t, SSTableMeta>::iterator it = TransID2SSTMeta_.find(SST_NUM);
-        uint32_t cf_id = static_cast<uint32_t>(it->second.cf_id);
-        uint64_t old_id = it->second.SST_ID;
-        db_->DetachSSTFile(cf_id, old_id);
-    }
-    return status;
+Status LSM2LIX::Get(uint64_t key, ROCKSDB_NAMESPACE::PinnableSlice* value) {
+    KeyIndex::IntKeyAsSlice key_slice(key);
+    return GetImpl(key, key_slice.as<ROCKSDB_NAMESPACE::Slice>(), value);
 }
 
-Status LSM2LIX::RecovermLogFile() {
+Status LSM2LIX::GetImpl(uint64_t key_num, const ROCKSDB_NAMESPACE::Slice& key, ROCKSDB_NAMESPACE::PinnableSlice* value) {
+#ifdef TIMING
+    using std::chrono::high_resolution_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::duration;
+    using std::chrono::microseconds;
+
+    std::chrono::microseconds us_lsm;
+#endif
     Status status;
-    class LogReporter : public LOG::LOG_Reader::Reporter {
-        public:
-        LogReporter() : dropped_bytes_(0) {}
-        void Corruption(size_t bytes, const Status& s) override {
-            dropped_bytes_ += bytes;
-            message_.append(s.ToString());
+    // A cached row has not been overwritten since it was read from LIX, so it is checked first.
+    std::string row_key;
+    uint64_t row_version = 0;
+    if (row_cache_ != nullptr) {
+        row_key = key.ToString();
+        row_version = row_cache_->Version(row_key);
+        if (row_cache_->Lookup(row_key, value->GetSelf())) {
+            value->PinSelf();
+            return status;
         }
-        size_t dropped_bytes_;
-        std::string message_;
-    };
-
-    // Open the log file
-    std::vector<std::string> log_path;
-    std::string fname;
-    LOG::LoadFileList(DB_path_, &log_path, mLOG_type);
-    if (log_path.empty()) { // no mLog file
-        return status;
-    } else {
-        fname = DB_path_ + "/" + log_path.back();
+    }
+#ifdef TIMING
+    auto t0 = high_resolution_clock::now();
+#endif
+    ROCKSDB_NAMESPACE::Status s;
+    std::shared_ptr<SpeculativeRead> spec;
+    {
+    std::shared_lock<std::shared_mutex> lock(dispatch_mutex_);
+    uint32_t handle_num = partitioner_.Route(key_num);
+    if (!MayResideInLSM(handle_num, key_num)) {
+        s = ROCKSDB_NAMESPACE::Status::NotFound();
+    } else {
+        spec = StartSpeculativeRead(key, key_num);
+        s = db_->Get(ropts_, handles_[handle_num], key, value);
+        if (s.ok() && hotness_ != nullptr) {
+            hotness_->RecordRead(handle_num, key_num);
+        }
+    }
+    if (s.IsNotFound() && partitioner_.Migrating() && partitioner_.RoutePrevious(key_num) != handle_num) {
+        value->Reset();
+        s = db_->Get(ropts_, handles_[partitioner_.RoutePrevious(key_num)], key, value);
+    }
+    }
+#ifdef TIMING
+    auto t1 = high_resolution_clock::now();
+    us_lsm = duration_cast<microseconds>(t1 - t0);
+#endif
+    if (spec != nullptr && !s.IsNotFound()) {
+        // The LSM-tree holds the newest version; drop whatever LIX returns.
+        DiscardSpeculativeRead(spec);
+    }
+    if (s.IsNotFound()) {
+        if (spec != nullptr) {
+            spec->done.wait();
+            if (spec->epoch == lix_epoch_.load()) {
+                status = spec->status;
+                value->GetSelf()->swap(spec->value);
+                value->PinSelf();
+            } else {
+                // A transfer moved keys out of the LSM-tree while the speculative read ran,
+                // so LIX may have gained a newer version than the one read.
+                DiscardSpeculativeRead(spec);
+                status = GetFromLIX(key, key_num, value);
+            }
+        } else {
+            status = GetFromLIX(key, key_num, value);
+        }
+        if (status.ok() && row_cache_ != nullptr) {
+            row_cache_->Insert(row_key, value->ToString(), value->size(), row_version);
+        }
+        if (status.ok() && promotion_sketch_ != nullptr) {
+            MaybePromote(key, key_num);
+        }
+    }
+    return status;
+}
+
+void LSM2LIX::MultiGet(size_t num_keys, const ROCKSDB_NAMESPACE::Slice* keys,
+                       ROCKSDB_NAMESPACE::PinnableSlice* values, Status* statuses) {
+    std::vector<uint64_t> key_nums(num_keys);
+    std::vector<std::string> row_keys(row_cache_ != nullptr ? num_keys : 0);
+    std::vector<uint64_t> row_versions(row_keys.size(), 0);
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < num_keys; i++) {
+        key_nums[i] = KeyIndex::ExtractHead64(keys[i]);
+        values[i].Reset();
+        statuses[i] = Status::OK();
+        if (row_cache_ != nullptr) {
+            row_keys[i] = keys[i].ToString();
+            row_versions[i] = row_cache_->Version(row_keys[i]);
+            if (row_cache_->Lookup(row_keys[i], values[i].GetSelf())) {
+                values[i].PinSelf();
+                continue;
+            }
+        }
+        pending.push_back(i);
+    }
+
+    std::vector<size_t> lix_indexes;
+    {
+    std::shared_lock<std::shared_mutex> lock(dispatch_mutex_);
+    std::vector<std::vector<size_t>> batches(handles_.size());
+    std::vector<size_t> lsm_missed;
+    for (size_t i : pending) {
+        uint32_t handle_num = partitioner_.Route(key_nums[i]);
+        if (MayResideInLSM(handle_num, key_nums[i])) {
+            batches[handle_num].push_back(i);
+        } else {
+            lsm_missed.push_back(i);
+        }
+    }
+    for (uint32_t handle_num = 0; handle_num < batches.size(); handle_num++) {
+        const std::vector<size_t>& batch = batches[handle_num];
+        if (batch.empty()) {
+            continue;
+        }
+        std::vector<ROCKSDB_NAMESPACE::Slice> batch_keys;
+        for (size_t i : batch) {
+            batch_keys.push_back(keys[i]);
+        }
+        std::vector<ROCKSDB_NAMESPACE::PinnableSlice> batch_values(batch.size());
+        std::vector<ROCKSDB_NAMESPACE::Status> batch_statuses(batch.size());
+        db_->MultiGet(ropts_, handles_[handle_num], batch.size(), batch_keys.data(), batch_values.data(), batch_statuses.data());
+        for (size_t j = 0; j < batch.size(); j++) {
+            size_t i = batch[j];
+            if (batch_statuses[j].IsNotFound()) {
+                lsm_missed.push_back(i);
+                continue;
+            }
+            statuses[i] = FromRocksDBStatus(batch_statuses[j]);
+            if (statuses[i].ok()) {
+                values[i] = std::move(batch_values[j]);
+                if (hotness_ != nullptr) {
+                    hotness_->RecordRead(handle_num, key_nums[i]);
+                }
+            }
+        }
+    }
+    for (size_t i : lsm_missed) {
+        uint32_t previous = partitioner_.RoutePrevious(key_nums[i]);
+        if (partitioner_.Migrating() && previous != partitioner_.Route(key_nums[i])) {
+            ROCKSDB_NAMESPACE::Status s = db_->Get(ropts_, handles_[previous], keys[i], &values[i]);
+            if (!s.IsNotFound()) {
+                statuses[i] = FromRocksDBStatus(s);
+                continue;
+            }
+            values[i].Reset();
+        }
+        lix_indexes.push_back(i);
+    }
+    }
+
+    MultiGetFromLIX(keys, key_nums.data(), lix_indexes, values, statuses);
+    for (size_t i : lix_indexes) {
+        if (statuses[i].ok() && row_cache_ != nullptr) {
+            row_cache_->Insert(row_keys[i], values[i].ToString(), values[i].size(), row_versions[i]);
+        }
+        if (statuses[i].ok() && promotion_sketch_ != nullptr) {
+            MaybePromote(keys[i], key_nums[i]);
+        }
+    }
+}
+
+// A batch goes through LIX in stages rather than one key at a time: the
+// handle cache sets and data blocks of the whole batch are prefetched before
+// the first of them is waited on. Each block is then read and searched in turn.
+void LSM2LIX::MultiGetFromLIX(const ROCKSDB_NAMESPACE::Slice* keys, const uint64_t* key_nums, const std::vector<size_t>& indexes,
+                              ROCKSDB_NAMESPACE::PinnableSlice* values, Status* statuses) {
+    struct BlockLookup {
+        size_t index;
+        uint64_t filenum;
+        BlockHandle handle;
+    };
+    std::vector<BlockLookup> lookups;
+    // Stage 1: resolve the block handles, with the handle cache sets of the batch loaded in parallel.
+    for (size_t i = 0; handle_cache_ != nullptr && i < indexes.size(); i++) {
+        handle_cache_->Prefetch(key_nums[indexes[i]]);
+    }
+    for (size_t i : indexes) {
+        uint64_t filenum, offset, size;
+        bool is_inline = false;
+        std::string inline_value;
+        statuses[i] = LookupBlockHandle(key_nums[i], &filenum, &offset, &size, &is_inline, &inline_value);
+        if (!statuses[i].ok()) {
+            continue;
+        }
+        if (is_inline) {
+            values[i].PinSelf(ROCKSDB_NAMESPACE::Slice(inline_value));
+            continue;
+        }
+        lookups.push_back(BlockLookup{i, filenum, BlockHandle{.offset_ = offset, .size_ = size}});
+    }
+    // Keys sharing a block are served by one read, in key order.
+    std::sort(lookups.begin(), lookups.end(), [&](const BlockLookup& a, const BlockLookup& b) {
+        if (a.filenum != b.filenum) {
+            return a.filenum < b.filenum;
+        }
+        if (a.handle.offset_ != b.handle.offset_) {
+            return a.handle.offset_ < b.handle.offset_;
+        }
+        return key_nums[a.index] < key_nums[b.index];
+    });
+    std::vector<size_t> block_starts;
+    for (size_t j = 0; j < lookups.size(); j++) {
+        if (j == 0 || lookups[j].filenum != lookups[j - 1].filenum || lookups[j].handle.offset_ != lookups[j - 1].handle.offset_) {
+            block_starts.push_back(j);
+        }
+    }
+    block_starts.push_back(lookups.size());
+    // Stage 2: start reading all blocks but the first, which stage 3 reads right away,
+    // so the device serves them while the earlier ones are searched.
+    for (size_t b = 1; b + 1 < block_starts.size(); b++) {
+        const BlockLookup& lookup = lookups[block_starts[b]];
+        SSTableMeta stm;
+        bool detaching = TransID2SSTMeta_.Lookup(lookup.filenum, &stm) && stm.flag == Detaching;
+        std::string filename = detaching ? MakeTableFileName(LSM_path_, stm.SST_ID) : MakeTransFileName(LSM_path_, lookup.filenum);
+        Reader hint_reader;
+        hint_reader.SetDirectIO(lsm2lix_options_.align_data_blocks);
+        hint_reader.SetFileCache(detaching ? nullptr : file_cache_); // Old names are never mapped, as in ReadLIXBlock
+        hint_reader.SetSSTFileName(filename);
+        hint_reader.Prefetch(lookup.handle);
+    }
+    // Stage 3: read a group of blocks, then walk the searches of all their keys
+    // in lockstep, prefetching what the next step of each reads, so that the
+    // cache misses of the bucket, restart entry and first entry overlap.
+    for (size_t g = 0; g + 1 < block_starts.size(); g += kMultiGetGroup) {
+        size_t group_size = std::min(kMultiGetGroup, block_starts.size() - 1 - g);
+        std::unique_ptr<Reader[]> readers(new Reader[group_size]);
+        std::vector<Status> block_statuses(group_size);
+        std::unique_ptr<bool[]> files_missing(new bool[group_size]());
+        for (size_t b = 0; b < group_size; b++) {
+            BlockLookup& first = lookups[block_starts[g + b]];
+            block_statuses[b] = ReadLIXBlock(first.filenum, first.handle, &readers[b], &files_missing[b]);
+        }
+        for (int stage = 0; stage < 3; stage++) {
+            for (size_t b = 0; b < group_size; b++) {
+                for (size_t j = block_starts[g + b]; block_statuses[b].ok() && j < block_starts[g + b + 1]; j++) {
+                    const ROCKSDB_NAMESPACE::Slice& key = keys[lookups[j].index];
+                    readers[b].PrefetchForGet(Slice(key.data(), key.size()), stage);
+                }
+            }
+        }
+        for (size_t b = 0; b < group_size; b++) {
+            for (size_t j = block_starts[g + b]; j < block_starts[g + b + 1]; j++) {
+                size_t i = lookups[j].index;
+                if (block_statuses[b].ok()) {
+                    statuses[i] = PinFromBlock(&readers[b], keys[i], &values[i]);
+                } else if (files_missing[b]) {
+                    // A GC or merge remapped the key and deleted its file after the index was read.
+                    statuses[i] = GetFromLIX(keys[i], key_nums[i], &values[i]);
+                } else {
+                    statuses[i] = block_statuses[b];
+                }
+            }
+            readers[b].FreeBuf();
+        }
+    }
+}
+
+Status LSM2LIX::GetFromLIX(const ROCKSDB_NAMESPACE::Slice& key, uint64_t key_num, std::string* value, uint64_t* block_bytes) {
+    ROCKSDB_NAMESPACE::PinnableSlice pinnable(value);
+    return CopyPinned(GetFromLIX(key, key_num, &pinnable, block_bytes), pinnable, value);
+}
+
+Status LSM2LIX::GetFromLIX(const ROCKSDB_NAMESPACE::Slice& key, uint64_t key_num, ROCKSDB_NAMESPACE::PinnableSlice* value,
+                           uint64_t* block_bytes) {
+    bool file_missing = false;
+    Status status = ReadThroughLIX(key, key_num, value, block_bytes, &file_missing);
+    if (file_missing) {
+        // A GC or merge remapped the key and deleted its file after the index was read.
+        status = ReadThroughLIX(key, key_num, value, block_bytes, &file_missing);
+    }
+    return status;
+}
+
+// Cleanup of a value pinned in a data block read through LIX.
+static void ReleasePinnedBlock(void* arg1, void* /* arg2 */) {
+    delete static_cast<std::shared_ptr<const void>*>(arg1);
+}
+
+Status LSM2LIX::ReadThroughLIX(const ROCKSDB_NAMESPACE::Slice& key, uint64_t key_num, ROCKSDB_NAMESPACE::PinnableSlice* value,
+                               uint64_t* block_bytes, bool* file_missing) {
+#ifdef TIMING
+    using std::chrono::high_resolution_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::duration;
+    using std::chrono::microseconds;
+
+    std::chrono::microseconds us_lix, us_block, us_get;
+#endif
+    Status status;
+    uint64_t filenum, offset, size;
+    bool is_inline = false;
+    std::string inline_value;
+#ifdef TIMING
+    auto t2 = high_resolution_clock::now();
+#endif
+    status = LookupBlockHandle(key_num, &filenum, &offset, &size, &is_inline, &inline_value);
+#ifdef TIMING
+    auto t3 = high_resolution_clock::now();
+    us_lix = duration_cast<microseconds>(t3 - t2);
+#endif
+    if (!status.ok()) {
+        return status;
+    }
+    if (is_inline) {
+        value->PinSelf(ROCKSDB_NAMESPACE::Slice(inline_value));
+        return status;
+    }
+    if (block_bytes != nullptr) {
+        *block_bytes = size;
+    }
+    BlockHandle handle = {.offset_ = offset, .size_ = size};
+    Reader datablock_reader;
+#ifdef TIMING
+    auto t4 = high_resolution_clock::now();
+#endif
+    status = ReadLIXBlock(filenum, handle, &datablock_reader, file_missing);
+#ifdef TIMING
+    auto t5 = high_resolution_clock::now();
+    us_block = duration_cast<microseconds>(t5 - t4);
+#endif
+    if (status.ok()) {
+#ifdef TIMING
+        auto t8 = high_resolution_clock::now();
+#endif
+        status = PinFromBlock(&datablock_reader, key, value);
+#ifdef TIMING
+        auto t9 = high_resolution_clock::now();
+        us_get = duration_cast<microseconds>(t9 - t8);
+#endif
+    }
+    datablock_reader.FreeBuf();
+    return status;
+}
+
+Status LSM2LIX::LookupBlockHandle(uint64_t key_num, uint64_t* filenum, uint64_t* offset, uint64_t* size,
+                                  bool* is_inline, std::string* inline_value) {
+    std::string offset_value;
+    uint64_t packed_handle, cache_version = 0;
+    if (handle_cache_ != nullptr && handle_cache_->Lookup(key_num, &packed_handle, &cache_version)) {
+        KeyIndex::OffsetToBlockHandle(reinterpret_cast<char*>(&packed_handle), filenum, offset, size);
+        return Status::OK();
+    }
+    tl::Status tls = tldbs_[LIXOf(key_num)]->Get(key_num, &offset_value);
+    if (tls.IsNotFound()) {
+        return Status::NotFound("Key is not found.");
+    }
+    const char* handle_value = offset_value.data();
+    size_t handle_length = offset_value.size();
+    if (inline_values_) {
+        if (handle_length > 0 && handle_value[0] == INLINE_TAG) {
+            *is_inline = true;
+            inline_value->assign(handle_value + 1, handle_length - 1);
+            return Status::OK();
+        }
+        handle_value++;
+        handle_length = handle_length > 0 ? handle_length - 1 : 0;
+    }
+    if (!KeyIndex::DecodeBlockHandle(handle_value, handle_length, filenum, offset, size)) {
+        return Status::Corruption("Malformed block handle.");
+    }
+    // The cache holds handles in the compact layout; wide ones are always read from LIX.
+    if (handle_cache_ != nullptr && KeyIndex::FitsCompactHandle(*filenum, *offset, *size)) {
+        KeyIndex::BlockHandleToOffset(*filenum, *offset, *size, reinterpret_cast<char*>(&packed_handle));
+        handle_cache_->Insert(key_num, packed_handle, cache_version);
+    }
+    return Status::OK();
+}
+
+Status LSM2LIX::ReadLIXBlock(uint64_t filenum, BlockHandle& handle, Reader* datablock_reader, bool* file_missing) {
+    Status status;
+    std::string filename, filename_old;
+    datablock_reader->AllocateBuf();
+    datablock_reader->SetVerifyChecksums(lsm2lix_options_.verify_block_checksums);
+    datablock_reader->SetDirectIO(lsm2lix_options_.align_data_blocks);
+    datablock_reader->SetFileCache(file_cache_);
+    bool read = false;
+    // A transfer id never names another file, so its blocks can be cached for good.
+    std::string block_key;
+    uint64_t block_version = 0;
+    if (block_cache_ != nullptr) {
+        block_key.resize(2 * sizeof(uint64_t));
+        EncodeFixed64(&block_key[0], filenum);
+        EncodeFixed64(&block_key[sizeof(uint64_t)], handle.offset_);
+        block_version = block_cache_->Version(block_key);
+        std::shared_ptr<const std::string> contents;
+        if (block_cache_->Lookup(block_key, &contents)) {
+            datablock_reader->SetBlockContents(contents);
+            return status;
+        }
+    }
+    // Find Sst id.
+    SSTableMeta stm;
+    if (TransID2SSTMeta_.Lookup(filenum, &stm) && stm.flag == Detaching) {
+        filename_old = MakeTableFileName(LSM_path_, stm.SST_ID);
+        datablock_reader->SetSSTFileName(filename_old);
+        // Read without the file cache: a mapping of the old name would keep serving
+        // reads after the rename, and pin the space of the file once it is removed.
+        datablock_reader->SetFileCache(nullptr);
+        status = datablock_reader->ReadBlockContents(handle);
+        datablock_reader->SetFileCache(file_cache_);
+        if (status.IsNotFound()) { // Old SST file name is out-of-date.
+            MarkDetached(filenum);
+        } else {
+            read = true;
+        }
+    }
+    if (!read) {
+        filename = MakeTransFileName(LSM_path_, filenum);
+        datablock_reader->SetSSTFileName(filename);
+        status = datablock_reader->ReadBlockContents(handle);
+        *file_missing = status.IsNotFound();
+    }
+    if (!status.ok()) {
+        if (!status.IsCorruption() && !status.IsNotSupportedError()) {
+            status = Status::IOError("Data block can not be read.");
+        }
+    } else {
+        std::shared_ptr<const std::string> contents = datablock_reader->DecompressedContents();
+        if (block_cache_ != nullptr && contents != nullptr) {
+            block_cache_->Insert(block_key, contents, contents->size(), block_version);
+        }
+    }
+    return status;
+}
+
+Status LSM2LIX::PinFromBlock(Reader* datablock_reader, const ROCKSDB_NAMESPACE::Slice& key,
+                             ROCKSDB_NAMESPACE::PinnableSlice* value) {
+    Slice block_value;
+    std::shared_ptr<const void> pin;
+    Status status = datablock_reader->GetPinned(Slice(key.data(), key.size()), &block_value, &pin); // Keys may hold zero bytes
+    if (!status.ok()) {
+        return Status::NotFound("Key is not found in data block.");
+    }
+    value->PinSlice(ROCKSDB_NAMESPACE::Slice(block_value.data(), block_value.size()), &ReleasePinnedBlock,
+                    new std::shared_ptr<const void>(std::move(pin)), nullptr);
+    return status;
+}
+
+std::shared_ptr<LSM2LIX::SpeculativeRead> LSM2LIX::StartSpeculativeRead(const ROCKSDB_NAMESPACE::Slice& key, uint64_t key_num) {
+    if (spec_pool_ == nullptr) {
+        return nullptr;
+    }
+    // A saturated pool would only add queueing delay to the misses it is meant to speed up.
+    if (speculative_inflight_.fetch_add(1) >= 2 * lsm2lix_options_.speculative_threads) {
+        speculative_inflight_--;
+        return nullptr;
+    }
+    std::shared_ptr<SpeculativeRead> spec = std::make_shared<SpeculativeRead>();
+    spec->key = key.ToString();
+    spec->epoch = lix_epoch_.load();
+    spec->done = spec->finished.get_future().share();
+    speculative_reads_++;
+    // The task owns its state, so Get may return before it runs.
+    spec_pool_->Schedule([this, spec, key_num]() {
+        spec->status = GetFromLIX(spec->key, key_num, &spec->value, &spec->block_bytes);
+        if (spec->stage.exchange(kSpecFinished) == kSpecDiscarded) {
+            speculative_wasted_bytes_ += spec->block_bytes;
+        }
+        speculative_inflight_--;
+        spec->finished.set_value();
+    });
+    return spec;
+}
+
+void LSM2LIX::DiscardSpeculativeRead(const std::shared_ptr<SpeculativeRead>& spec) {
+    speculative_wasted_++;
+    // Whichever side comes second accounts for the block the read fetched.
+    if (spec->stage.exchange(kSpecDiscarded) == kSpecFinished) {
+        speculative_wasted_bytes_ += spec->block_bytes;
+    }
+}
+
+void LSM2LIX::MaybePromote(const ROCKSDB_NAMESPACE::Slice& key, uint64_t key_num) {
+    if (promotion_sketch_->Increment(key_num) < lsm2lix_options_.promotion_threshold) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(promotion_mutex_);
+    if (bg_pool_ == nullptr || promotion_queue_.size() >= kMaxPromotionQueue) {
+        return;
+    }
+    promotion_queue_.push_back(key.ToString());
+    if (!promotion_scheduled_) {
+        promotion_scheduled_ = true;
+        bg_pool_->Schedule([this] { PromoteQueuedKeys(); });
+    }
+}
+
+void LSM2LIX::PromoteQueuedKeys() {
+    std::vector<std::string> keys;
+    {
+    std::unique_lock<std::mutex> lock(promotion_mutex_);
+    keys.swap(promotion_queue_);
+    promotion_scheduled_ = false;
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    promoted_keys_ += PromoteKeys(keys);
+}
+
+size_t LSM2LIX::WriteStripe(uint64_t key_num) const {
+    return HashKeyNum(key_num) % kWriteStripes;
+}
+
+void LSM2LIX::FinishDispatch(const uint64_t* key_nums, size_t count) {
+    for (size_t i = 0; writes_done_ != nullptr && i < count; i++) {
+        writes_done_[WriteStripe(key_nums[i])].fetch_add(1);
+    }
+}
+
+uint64_t LSM2LIX::PromoteKeys(const std::vector<std::string>& keys) {
+    uint64_t promoted = 0;
+    for (size_t begin = 0; begin < keys.size(); begin += kPromotionBatch) {
+        size_t end = std::min(keys.size(), begin + kPromotionBatch);
+        // Set before the stamps are read, so a write stamped after them waits for ours.
+        promoting_.store(true);
+        std::vector<uint64_t> stamps(end - begin);
+        std::vector<bool> settled(end - begin);
+        for (size_t i = begin; i < end; i++) {
+            size_t stripe = WriteStripe(KeyIndex::ExtractHead64(keys[i]));
+            stamps[i - begin] = writes_started_[stripe].load();
+            // Every write dispatched before the stamp has landed, so the reads below see it.
+            settled[i - begin] = writes_done_[stripe].load() == stamps[i - begin];
+        }
+        std::vector<std::pair<size_t, std::string>> values;
+        {
+        std::shared_lock<std::shared_mutex> lock(dispatch_mutex_);
+        for (size_t i = begin; i < end; i++) {
+            if (!settled[i - begin]) { // Being written, so it is in an LSM-tree anyway
+                continue;
+            }
+            const std::string& key = keys[i];
+            uint64_t key_num = KeyIndex::ExtractHead64(key);
+            uint32_t handle_num = partitioner_.Route(key_num);
+            std::string value;
+            ROCKSDB_NAMESPACE::Status s = db_->Get(ropts_, handles_[handle_num], key, &value);
+            if (s.IsNotFound() && partitioner_.Migrating() && partitioner_.RoutePrevious(key_num) != handle_num) {
+                s = db_->Get(ropts_, handles_[partitioner_.RoutePrevious(key_num)], key, &value);
+            }
+            if (!s.IsNotFound()) { // Already in an LSM-tree, or unreadable
+                continue;
+            }
+            // LIX is read after the LSM-trees, as in Get, so a transfer racing with
+            // the check above has already indexed the newest version.
+            if (!GetFromLIX(key, key_num, &value).ok()) {
+                continue;
+            }
+            values.emplace_back(i, std::move(value));
+        }
+        }
+        std::shared_lock<std::shared_mutex> lock(dispatch_mutex_);
+        std::unique_lock<std::mutex> promote_lock(promote_mutex_);
+        ROCKSDB_NAMESPACE::WriteBatch batch;
+        size_t batched = 0;
+        for (size_t j = 0; j < values.size(); j++) {
+            const std::string& key = keys[values[j].first];
+            uint64_t key_num = KeyIndex::ExtractHead64(key);
+            if (writes_started_[WriteStripe(key_num)].load() != stamps[values[j].first - begin]) { // Written since it was read
+                continue;
+            }
+            DispatchPut(key_num, key, values[j].second, &batch, /*promotion*/true);
+            batched++;
+        }
+        // promote_mutex_ is held across the write, so a Put stamped after the check lands after it.
+        if (batched > 0 && db_->Write(wopts_, &batch).ok()) {
+            promoted += batched;
+        }
+        promoting_.store(false);
+    }
+    return promoted;
+}
+
+void LSM2LIX::KeepHotKeys(const std::vector<std::string>& keys) {
+    if (promotion_sketch_ == nullptr) {
+        return;
+    }
+    // Promoted from LIX once the transfer has indexed them, off the compaction thread.
+    std::unique_lock<std::mutex> lock(promotion_mutex_);
+    for (size_t i = 0; i < keys.size() && promotion_queue_.size() < kMaxPromotionQueue; i++) {
+        if (promotion_sketch_->Estimate(KeyIndex::ExtractHead64(keys[i])) >= lsm2lix_options_.promotion_threshold) {
+            promotion_queue_.push_back(keys[i]);
+        }
+    }
+    if (bg_pool_ != nullptr && !promotion_queue_.empty() && !promotion_scheduled_) {
+        promotion_scheduled_ = true;
+        bg_pool_->Schedule([this] { PromoteQueuedKeys(); });
+    }
+}
+
+void LSM2LIX::GetStats(LSM2LIXStats* stats) const {
+    stats->speculative_lix_reads = speculative_reads_.load();
+    stats->wasted_lix_reads = speculative_wasted_.load();
+    stats->wasted_block_bytes = speculative_wasted_bytes_.load();
+    stats->promoted_keys = promoted_keys_.load();
+    stats->gc_files_rewritten = gc_files_rewritten_.load();
+    stats->gc_bytes_reclaimed = gc_bytes_reclaimed_.load();
+}
+
+Status LSM2LIX::BatchUpdate_LIX(std::vector<tl::pg::Record>& pairs, uint64_t old_id, uint64_t new_id, uint32_t cf_id, bool redo){
+    // Todo: RW-Lock
+    Status status;
+    tl::Status tls;
+
+    char record_buf[60];
+    uint64_t offset = 0;
+    uint64_t smallest_key = pairs.front().first;
+    uint64_t largest_key = pairs.back().first;
+    { // Skip keys a rebalance moved to another partition; their owner has a newer copy.
+    std::shared_lock<std::shared_mutex> lock(dispatch_mutex_);
+    uint32_t partition_num = PartitionOfCF(cf_id);
+    pairs.erase(std::remove_if(pairs.begin(), pairs.end(), [&](const tl::pg::Record& pair) {
+        return partitioner_.Route(pair.first) != partition_num;
+    }), pairs.end());
+    }
+    { // lock phase
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (!redo) {
+        SSTableMeta stm = {.SST_ID = old_id, .cf_id = cf_id, .smallest_key = smallest_key, .largest_key = largest_key, .flag = Transfering};
+        if (!TransID2SSTMeta_.Insert(new_id, stm)) { // The SST stays in the LSM-tree
+            return Status::NotSupported("Transfer id beyond the capacity of the metatable.");
+        }
+        TransID2SSTMeta_.SetEntryCounts(new_id, pairs.size(), pairs.size());
+        // Add a record in the mLog
+        uint64_t record_type = insert;
+        EncodeFixed64(record_buf + offset, record_type);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, new_id);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, old_id);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, cf_id);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, smallest_key);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, largest_key);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, static_cast<uint64_t>(Transfering));
+        offset += sizeof(uint64_t);
+        mLogWriter_->AddRecord(Slice(record_buf, offset));
+    }
+    } // lock phase 
+    // The pairs are sorted, so every LIX instance receives one contiguous run.
+    std::vector<std::vector<tl::pg::Record>> runs(lix_cnt_ > 1 ? lix_cnt_ : 0);
+    for (size_t i = 0; lix_cnt_ > 1 && i < pairs.size(); i++) {
+        runs[LIXOf(pairs[i].first)].push_back(pairs[i]);
+    }
+    // Entries each older file loses to this one, counted while the handles are replaced.
+    bool count_superseded = !redo && lsm2lix_options_.gc_live_ratio > 0;
+    std::map<uint64_t, uint32_t> superseded;
+    std::shared_lock<std::shared_mutex> remap_lock(lix_remap_mutex_);
+    for (uint32_t i = 0; i < lix_cnt_; i++) {
+        std::vector<tl::pg::Record>& run = lix_cnt_ > 1 ? runs[i] : pairs;
+        if (run.empty()) {
+            continue;
+        }
+        for (size_t j = 0; count_superseded && !bulkload_[i] && j < run.size(); j++) {
+            uint64_t filenum = LIXFileOf(run[j].first);
+            if (filenum != kNoSSTID) {
+                superseded[filenum]++;
+            }
+        }
+        bool bulkload = false;
+        { // lock phase
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        if (bulkload_[i]) {
+            bulkload = true;
+            tls = tldbs_[i]->BulkLoad(run);
+            bulkload_[i] = false;
+        }
+        } // lock phase
+        if (!bulkload) {
+            tls = tldbs_[i]->PutBatch(run);
+        }
+        if (!tls.ok()) {
+            status = Status::IOError("Batch Load Failed.");
+        }
+        for (size_t j = 0; handle_cache_ != nullptr && j < run.size(); j++) {
+            handle_cache_->Erase(run[j].first);
+        }
+    }
+    // The keys are in LIX before their SST leaves the LSM-tree, so a speculative
+    // read that predates this point is retried once the LSM-tree misses.
+    lix_epoch_++;
+    remap_lock.unlock();
+    if (!superseded.empty()) {
+        std::vector<uint64_t> file_ids;
+        for (const std::pair<const uint64_t, uint32_t>& lost : superseded) {
+            TransID2SSTMeta_.DropLiveEntries(lost.first, lost.second);
+            file_ids.push_back(lost.first);
+        }
+        ScheduleGC(file_ids);
+    }
+    { // lock phase
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    TransID2SSTMeta_.SetFlag(new_id, Detaching);
+    // Add a record in the mLog
+    uint64_t offset = 0;
+    uint64_t record_type = modify;
+    EncodeFixed64(record_buf + offset, record_type);
+    offset += sizeof(uint64_t);
+    EncodeFixed64(record_buf + offset, new_id);
+    offset += sizeof(uint64_t);
+    EncodeFixed64(record_buf + offset, Detaching);
+    offset += sizeof(uint64_t);
+    mLogWriter_->AddRecord(Slice(record_buf, offset));
+    } // lock phase
+    return status;
+}
+
+void LSM2LIX::MarkDetached(uint64_t file_id) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    SSTableMeta stm;
+    if (!TransID2SSTMeta_.Lookup(file_id, &stm) || !TransID2SSTMeta_.CompareAndSetFlag(file_id, Detaching, Normal)) {
+        return;
+    }
+    if (file_cache_ != nullptr) { // Nothing reads the old name from now on
+        file_cache_->Erase(MakeTableFileName(LSM_path_, stm.SST_ID));
+    }
+    // Add a record in the mLog
+    char record_buf[24];
+    uint64_t offset = 0;
+    uint64_t record_type = modify;
+    EncodeFixed64(record_buf + offset, record_type);
+    offset += sizeof(uint64_t);
+    EncodeFixed64(record_buf + offset, file_id);
+    offset += sizeof(uint64_t);
+    EncodeFixed64(record_buf + offset, Normal);
+    offset += sizeof(uint64_t);
+    mLogWriter_->AddRecord(Slice(record_buf, offset));
+}
+
+void LSM2LIX::Set_mLogWriter(LOG::LOG_Writer* mLogWriter) {
+    mLogWriter_ = mLogWriter;
+}
+
+Status LSM2LIX::RecoverStageI() {
+    Status status;
+    std::vector<std::string> mLOG_list, tLOG_list;
+    // First, we recover the table from the mLOG
+    status = RecovermLogFile();
+    // ExtractTodoList(&todolist_);
+    // status = RecovertLogFile(&todolist_);
+
+    detachlist_.clear();
+    todolist_.clear();
+    TransID2SSTMeta_.ForEach([this](uint64_t SST_NUM, const SSTableMeta& stm) {
+        if (stm.flag == Detaching) { // Manually rename to prevent the LSM-tree deleting the old SSTable file
+            std::string old_name = MakeTableFileName(LSM_path_, stm.SST_ID);
+            std::string new_name = MakeTransFileName(LSM_path_, SST_NUM);
+            if (std::rename(old_name.c_str(), new_name.c_str()) == 0) { // The SSTable has not been renamed before recovery
+                detachlist_.emplace_back(SST_NUM);
+            } else if (std::filesystem::exists(new_name)) { // Detached before the crash, only the flag was not logged
+                TransID2SSTMeta_.SetFlag(SST_NUM, Normal);
+            }
+        } else if (stm.flag == Transfering) {
+            todolist_.emplace_back(SST_NUM);
+        } else if (stm.flag == GCing) { // Both the rewritten file and its sources are readable
+            TransID2SSTMeta_.SetFlag(SST_NUM, Normal);
+        }
+    });
+    return status;
+}
+
+Status LSM2LIX::RecoverStageII() {
+    Status status;
+
+    // Rewrite the mLog
+    time_t now;
+    time(&now);
+    tm info;
+    char time_stamp[80];
+    localtime_r(&now, &info);
+    strftime(time_stamp, 80, "%Y-%m-%d-%H:%M:%S", &info);
+    std::string mlog_path = DB_path_ + "/" + time_stamp + "." + mLOG_suffix;
+    mlog_fd_ = ::open(mlog_path.c_str(), O_CREAT | O_RDWR);
+    mLogWriter_ = new LOG::LOG_Writer(mlog_fd_, mlog_path);
+    const std::pair<uint64_t, uint64_t> settings[] = {
+        {kPartitionCnt, partition_cnt_}, {kLIXPartitionCnt, lix_cnt_},
+        {kHandleFormat, handle_format_}, {kInlineValues, inline_values_},
+        {kNextTransID, next_trans_id_.load()}};
+    for (const auto& setting : settings) {
+        status = LogSetting(setting.first, setting.second);
+        if (!status.ok()) {
+            return status;
+        }
+    }
+    status = LogSplits(kCurrentSplits, partitioner_.Splits());
+    if (status.ok()) {
+        status = LogSplits(kPreviousSplits, partitioner_.PreviousSplits());
+    }
+    if (!status.ok()) {
+        return status;
+    }
+    TransID2SSTMeta_.ForEach([&](uint64_t SST_NUM, const SSTableMeta& stm) {
+        if (!status.ok()) {
+            return;
+        }
+        char record_buf[60];
+        uint64_t offset = 0;
+        uint64_t record_type = insert;
+        EncodeFixed64(record_buf + offset, record_type);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, SST_NUM);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, stm.SST_ID);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, stm.cf_id);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, stm.smallest_key);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, stm.largest_key);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, stm.flag);
+        offset += sizeof(uint64_t);
+        status = mLogWriter_->AddRecord(Slice(record_buf, offset));
+    });
+    if (!status.ok()) {
+        return status;
+    }
+    //TODO: the stale mLog file can be removed at here
+
+    // Replay the todolist
+    for (uint64_t SST_NUM : todolist_) {
+        SSTableMeta stm;
+        TransID2SSTMeta_.Lookup(SST_NUM, &stm);
+        uint32_t cf_id = static_cast<uint32_t>(stm.cf_id);
+        uint64_t old_id = stm.SST_ID;
+        uint64_t total_size = 0;
+        std::string old_name, old_path;
+        db_->SelectTransFile(0, &total_size, cf_id, &old_id, &old_name, &old_path, SST_NUM, /*force*/true);
+        std::string filename = MakeTableFileName(old_path, old_id);
+        std::vector<tl::pg::Record> pairs;
+        char* offset_values = LSM2LIX_Mover::GetTreeLineIndexPair(filename, SST_NUM, options_, ropts_, GetValueEncoding(), &pairs);
+        if (offset_values == nullptr) { // The SST stays in the LSM-tree
+            continue;
+        }
+        BatchUpdate_LIX(pairs, old_id, SST_NUM, cf_id, /*redo*/true);
+        detachlist_.emplace_back(SST_NUM);
+        delete[] offset_values;
+    }
+
+    // Replay the detachlist
+    for (uint64_t SST_NUM : detachlist_) {
+        SSTableMeta stm;
+        TransID2SSTMeta_.Lookup(SST_NUM, &stm);
+        uint32_t cf_id = static_cast<uint32_t>(stm.cf_id);
+        uint64_t old_id = stm.SST_ID;
+        if (db_->DetachSSTFile(cf_id, old_id).ok()) {
+            MarkDetached(SST_NUM);
+        }
+    }
+    return status;
+}
+
+Status LSM2LIX::RecovermLogFile() {
+    Status status;
+    class LogReporter : public LOG::LOG_Reader::Reporter {
+        public:
+        LogReporter() : dropped_bytes_(0) {}
+        void Corruption(size_t bytes, const Status& s) override {
+            dropped_bytes_ += bytes;
+            message_.append(s.ToString());
+        }
+        size_t dropped_bytes_;
+        std::string message_;
+    };
+
+    // Open the log file
+    std::vector<std::string> log_path;
+    std::string fname;
+    LOG::LoadFileList(DB_path_, &log_path, mLOG_type);
+    if (log_path.empty()) { // no mLog file
+        return status;
+    } else {
+        fname = DB_path_ + "/" + log_path.back();
+        partition_cnt_ = ColumnFamilyCnt; // DBs created before the settings were logged
+        lix_cnt_ = 1;
+        handle_format_ = kCompactHandles;
+        inline_values_ = false;
     }
     int fd = ::open(fname.c_str(), O_RDONLY);
     LogReporter reporter;
@@ -442,7 +1486,7 @@ Status LSM2LIX::RecovermLogFile() {
     std::cout << "Recovering log:" << fname << std::endl;
 
     // Read the Metatable and rebuild it.
-    TransID2SSTMeta_.clear();
+    TransID2SSTMeta_.Clear();
     std::string scratch;
     Slice record;
     while (reader.ReadRecord(&record, &scratch) && status.ok()) {
@@ -464,7 +1508,12 @@ Status LSM2LIX::RecovermLogFile() {
             offset += sizeof(uint64_t);
             uint64_t flag = DecodeFixed64(record.data() + offset);
             SSTableMeta stm = {.SST_ID = SST_ID, .cf_id = cf_id, .smallest_key = smallest_key, .largest_key = largest_key, .flag = flag};
-            TransID2SSTMeta_.emplace(SST_NUM, stm);
+            if (!TransID2SSTMeta_.Insert(SST_NUM, stm)) {
+                status = Status::Corruption("Transfer id beyond the capacity of the metatable, or inserted twice.");
+            }
+            if (SST_NUM >= next_trans_id_.load()) {
+                next_trans_id_.store(SST_NUM + 1);
+            }
             }
             break;
             case modify:
@@ -473,14 +1522,55 @@ Status LSM2LIX::RecovermLogFile() {
             uint64_t SST_NUM = DecodeFixed64(record.data() + offset);
             offset += sizeof(uint64_t);
             uint64_t flag = DecodeFixed64(record.data() + offset);
-            TransID2SSTMeta_.find(SST_NUM)->second.flag = flag;
+            TransID2SSTMeta_.SetFlag(SST_NUM, flag);
             }
             break;
             case remove:
             {
             offset += sizeof(uint64_t);
             uint64_t SST_NUM = DecodeFixed64(record.data() + offset);
-            TransID2SSTMeta_.erase(SST_NUM);
+            TransID2SSTMeta_.Remove(SST_NUM);
+            if (SST_NUM >= next_trans_id_.load()) {
+                next_trans_id_.store(SST_NUM + 1);
+            }
+            }
+            break;
+            case setting:
+            {
+            offset += sizeof(uint64_t);
+            uint64_t setting_id = DecodeFixed64(record.data() + offset);
+            offset += sizeof(uint64_t);
+            uint64_t value = DecodeFixed64(record.data() + offset);
+            if (setting_id == kPartitionCnt) {
+                partition_cnt_ = static_cast<uint32_t>(value);
+            } else if (setting_id == kLIXPartitionCnt) {
+                lix_cnt_ = static_cast<uint32_t>(value);
+            } else if (setting_id == kHandleFormat) {
+                handle_format_ = value;
+            } else if (setting_id == kInlineValues) {
+                inline_values_ = value != 0;
+            } else if (setting_id == kNextTransID && value > next_trans_id_.load()) {
+                next_trans_id_.store(value);
+            }
+            }
+            break;
+            case partition:
+            {
+            offset += sizeof(uint64_t);
+            uint64_t kind = DecodeFixed64(record.data() + offset);
+            offset += sizeof(uint64_t);
+            uint64_t count = DecodeFixed64(record.data() + offset);
+            offset += sizeof(uint64_t);
+            std::vector<uint64_t> splits;
+            for (uint64_t i = 0; i < count; i++) {
+                splits.push_back(DecodeFixed64(record.data() + offset));
+                offset += sizeof(uint64_t);
+            }
+            if (kind == kCurrentSplits) {
+                partitioner_.SetSplits(splits);
+            } else {
+                partitioner_.SetPreviousSplits(splits);
+            }
             }
             break;
         }
@@ -530,12 +1620,732 @@ Status LSM2LIX::RecovertLogFile(std::vector<uint64_t>* todolist) {
 
 void LSM2LIX::ExtractTodoList(std::vector<uint64_t>* todolist) {
     todolist->clear();
-    std::map<uint64_t, SSTableMeta>::iterator it;
-    for (it = TransID2SSTMeta_.begin(); it != TransID2SSTMeta_.end(); it++) {
-        if (it->second.flag == Transfering) {
-            todolist->emplace_back(it->first);
+    TransID2SSTMeta_.ForEach([todolist](uint64_t SST_NUM, const SSTableMeta& stm) {
+        if (stm.flag == Transfering) {
+            todolist->emplace_back(SST_NUM);
+        }
+    });
+}
+
+Status LSM2LIX::LogSetting(uint64_t setting_id, uint64_t value) {
+    char record_buf[24];
+    uint64_t offset = 0;
+    uint64_t record_type = setting;
+    EncodeFixed64(record_buf + offset, record_type);
+    offset += sizeof(uint64_t);
+    EncodeFixed64(record_buf + offset, setting_id);
+    offset += sizeof(uint64_t);
+    EncodeFixed64(record_buf + offset, value);
+    offset += sizeof(uint64_t);
+    return mLogWriter_->AddRecord(Slice(record_buf, offset));
+}
+
+Status LSM2LIX::LogSplits(uint64_t kind, const std::vector<uint64_t>& splits) {
+    std::string record;
+    PutFixed64(&record, partition);
+    PutFixed64(&record, kind);
+    PutFixed64(&record, splits.size());
+    for (uint64_t split : splits) {
+        PutFixed64(&record, split);
+    }
+    return mLogWriter_->AddRecord(Slice(record));
+}
+
+void LSM2LIX::LockTransfer() {
+    transfer_mutex_.lock_shared();
+}
+
+bool LSM2LIX::MayTransferRange(uint32_t cf_id, uint64_t smallest_key, uint64_t largest_key) {
+    std::shared_lock<std::shared_mutex> lock(dispatch_mutex_);
+    if (!partitioner_.Migrating()) {
+        return true;
+    }
+    // A source of the migration keeps the keys it hands over until every one has been moved:
+    // those of its previous range outside its current one.
+    uint32_t partition_num = PartitionOfCF(cf_id);
+    const std::vector<uint64_t>& splits = partitioner_.Splits();
+    const std::vector<uint64_t>& prev_splits = partitioner_.PreviousSplits();
+    bool last = partition_num + 1 >= partition_cnt_;
+    uint64_t lower = partition_num == 0 ? 0 : splits[partition_num - 1];
+    uint64_t prev_lower = partition_num == 0 ? 0 : prev_splits[partition_num - 1];
+    uint64_t last_key = last ? UINT64_MAX : splits[partition_num] - 1;
+    uint64_t prev_last_key = last ? UINT64_MAX : prev_splits[partition_num] - 1;
+    if (prev_lower < lower && smallest_key < lower && largest_key >= prev_lower) {
+        return false;
+    }
+    if (last_key < prev_last_key && largest_key > last_key && smallest_key <= prev_last_key) {
+        return false;
+    }
+    return true;
+}
+
+void LSM2LIX::UnlockTransfer() {
+    transfer_mutex_.unlock_shared();
+}
+
+void LSM2LIX::MaybeScheduleRebalance() {
+    if (rebalance_scheduled_.exchange(true)) {
+        return;
+    }
+    bg_pool_->Schedule([this] {
+        Rebalance();
+        rebalance_scheduled_.store(false);
+    });
+}
+
+Status LSM2LIX::Rebalance() {
+    std::unique_lock<std::mutex> rebalance_lock(rebalance_mutex_);
+    Status status;
+    if (!partitioner_.Migrating()) {
+        std::vector<uint64_t> splits;
+        if (!partitioner_.ProposeSplits(lsm2lix_options_.rebalance_threshold, &splits)) {
+            return status;
+        }
+        // Wait for in-flight transfers, which may still carry keys of the moved ranges.
+        std::unique_lock<std::shared_mutex> transfer_lock(transfer_mutex_);
+        std::unique_lock<std::shared_mutex> lock(dispatch_mutex_);
+        partitioner_.StartMigration(splits);
+        std::unique_lock<std::shared_mutex> meta_lock(mutex_);
+        status = LogSplits(kPreviousSplits, partitioner_.PreviousSplits());
+        if (status.ok()) {
+            status = LogSplits(kCurrentSplits, partitioner_.Splits());
+        }
+    }
+    if (status.ok()) {
+        status = MigratePartitions();
+    }
+    return status;
+}
+
+Status LSM2LIX::MigratePartitions() {
+    Status status;
+    // Every range between two consecutive old or new split points has a single old and new owner.
+    std::vector<uint64_t> bounds;
+    {
+    std::shared_lock<std::shared_mutex> lock(dispatch_mutex_);
+    bounds = partitioner_.Splits();
+    bounds.insert(bounds.end(), partitioner_.PreviousSplits().begin(), partitioner_.PreviousSplits().end());
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+    {
+    std::unique_lock<std::mutex> migrate_lock(migrate_mutex_);
+    migrate_done_below_.clear();
+    }
+    uint64_t lower = 0;
+    for (size_t i = 0; i <= bounds.size() && status.ok(); i++) {
+        bool to_end = (i == bounds.size());
+        uint64_t upper = to_end ? 0 : bounds[i];
+        status = MigrateRange(lower, upper, to_end);
+        lower = upper;
+    }
+    if (status.ok()) {
+        std::unique_lock<std::shared_mutex> lock(dispatch_mutex_);
+        partitioner_.FinishMigration();
+        {
+        std::unique_lock<std::mutex> migrate_lock(migrate_mutex_);
+        migrate_dirty_.clear();
+        }
+        std::unique_lock<std::shared_mutex> meta_lock(mutex_);
+        status = LogSplits(kPreviousSplits, partitioner_.PreviousSplits());
+    }
+    return status;
+}
+
+Status LSM2LIX::MigrateRange(uint64_t lower, uint64_t upper, bool to_end) {
+    static const size_t kMigrateBatchSize = 1024;
+    Status status;
+    uint32_t from, to;
+    {
+    std::shared_lock<std::shared_mutex> lock(dispatch_mutex_);
+    from = partitioner_.RoutePrevious(lower);
+    to = partitioner_.Route(lower);
+    }
+    if (from == to) {
+        return status;
+    }
+    std::string resume_key = KeyIndex::LowerBoundKey(lower);
+    bool done = false;
+    while (!done && status.ok()) {
+        // Foreground requests keep running: writes hold dispatch_mutex_ shared too,
+        // and a key they overwrite in the range is left to them.
+        std::shared_lock<std::shared_mutex> lock(dispatch_mutex_);
+        std::unique_ptr<ROCKSDB_NAMESPACE::Iterator> iter(db_->NewIterator(ropts_, handles_[from]));
+        std::vector<std::pair<std::string, std::string>> entries;
+        for (iter->Seek(resume_key); iter->Valid() && entries.size() < kMigrateBatchSize; iter->Next()) {
+            if (!to_end && KeyIndex::ExtractHead64(iter->key()) >= upper) {
+                done = true;
+                break;
+            }
+            entries.emplace_back(iter->key().ToString(), iter->value().ToString());
+        }
+        if (!iter->Valid()) {
+            done = true;
+        } else if (!done) {
+            resume_key = iter->key().ToString();
+        }
+        if (!iter->status().ok()) {
+            status = Status::IOError("Partition migration failed.");
+            break;
+        }
+        // A writer marks its key before writing it, so a key not marked here is
+        // either not written during this batch or written after it.
+        std::unique_lock<std::mutex> migrate_lock(migrate_mutex_);
+        ROCKSDB_NAMESPACE::WriteBatch batch;
+        for (const std::pair<std::string, std::string>& entry : entries) {
+            if (migrate_dirty_.count(entry.first) != 0) {
+                continue;
+            }
+            NoteResidency(to, KeyIndex::ExtractHead64(entry.first));
+            batch.Put(handles_[to], entry.first, entry.second);
+            batch.Delete(handles_[from], entry.first);
+        }
+        if (!db_->Write(wopts_, &batch).ok()) {
+            status = Status::IOError("Partition migration failed.");
+            break;
+        }
+        // The ranges are migrated in key order, so no key below the batch is read again.
+        if (done && to_end) {
+            migrate_dirty_.clear();
+            continue;
+        }
+        migrate_done_below_ = done ? KeyIndex::LowerBoundKey(upper) : resume_key;
+        migrate_dirty_.erase(migrate_dirty_.begin(), migrate_dirty_.lower_bound(migrate_done_below_));
+    }
+    return status;
+}
+
+void LSM2LIX::NoteResidency(uint32_t partition_num, uint64_t key_num) {
+    // REQUIRES: dispatch_mutex_ is held.
+    if (residency_filters_.empty()) {
+        return;
+    }
+    residency_filters_[2 * partition_num + residency_active_[partition_num]]->Add(key_num);
+    if (residency_rebuilding_[partition_num]) {
+        residency_filters_[2 * partition_num + 1 - residency_active_[partition_num]]->Add(key_num);
+    }
+}
+
+bool LSM2LIX::MayResideInLSM(uint32_t partition_num, uint64_t key_num) const {
+    // REQUIRES: dispatch_mutex_ is held.
+    // During a migration a key may also sit in its former owner, which the filter does not cover.
+    if (residency_filters_.empty() || !residency_ready_[partition_num] || partitioner_.Migrating()) {
+        return true;
+    }
+    return residency_filters_[2 * partition_num + residency_active_[partition_num]]->MayContain(key_num);
+}
+
+void LSM2LIX::OnTransferDone(uint32_t cf_id, const std::vector<std::pair<uint64_t, uint64_t>>& detached_ranges) {
+    if (!residency_filters_.empty()) { // Only the keys of the detached SSTs left the tree
+        for (const std::pair<uint64_t, uint64_t>& range : detached_ranges) {
+            ScheduleResidencyReset(PartitionOfCF(cf_id), range.first, range.second);
+        }
+    }
+    if (lsm2lix_options_.merge_file_bytes > 0 && bg_pool_ != nullptr && !merge_scheduled_.exchange(true)) {
+        bg_pool_->Schedule([this] {
+            merge_scheduled_.store(false);
+            MergeSmallFiles();
+        });
+    }
+}
+
+void LSM2LIX::ScheduleResidencyRebuild(uint32_t partition_num) {
+    std::lock_guard<std::mutex> lock(residency_mutex_);
+    residency_full_[partition_num] = true;
+    ScheduleResidencyWork(partition_num);
+}
+
+void LSM2LIX::ScheduleResidencyReset(uint32_t partition_num, uint64_t smallest_key, uint64_t largest_key) {
+    std::lock_guard<std::mutex> lock(residency_mutex_);
+    residency_ranges_[partition_num].emplace_back(smallest_key, largest_key);
+    ScheduleResidencyWork(partition_num);
+}
+
+void LSM2LIX::ScheduleResidencyWork(uint32_t partition_num) {
+    // REQUIRES: residency_mutex_ is held.
+    if (bg_pool_ == nullptr) { // Transfers while opening are covered by the rebuild after recovery
+        return;
+    }
+    if (residency_scheduled_[partition_num]) {
+        return;
+    }
+    residency_scheduled_[partition_num] = true;
+    bg_pool_->Schedule([this, partition_num] {
+        bool full;
+        std::vector<std::pair<uint64_t, uint64_t>> ranges;
+        {
+        std::lock_guard<std::mutex> lock(residency_mutex_);
+        full = residency_full_[partition_num];
+        residency_full_[partition_num] = false;
+        ranges.swap(residency_ranges_[partition_num]);
+        residency_scheduled_[partition_num] = false;
+        }
+        if (full) { // Covers the queued ranges as well
+            RebuildResidencyFilter(partition_num);
+        } else {
+            ResetResidencyRanges(partition_num, std::move(ranges));
+        }
+    });
+}
+
+void LSM2LIX::RebuildResidencyFilter(uint32_t partition_num) {
+    // One segment per SST, so a later transfer only resets the segments of its file.
+    std::vector<uint64_t> bounds;
+    ROCKSDB_NAMESPACE::ColumnFamilyMetaData cf_meta;
+    db_->GetColumnFamilyMetaData(handles_[partition_num], &cf_meta);
+    for (const ROCKSDB_NAMESPACE::LevelMetaData& level : cf_meta.levels) {
+        for (const ROCKSDB_NAMESPACE::SstFileMetaData& file : level.files) {
+            bounds.push_back(KeyIndex::ExtractHead64(file.smallestkey));
+        }
+    }
+    std::sort(bounds.begin(), bounds.end());
+    ResidencyFilter* filter;
+    {
+    // Writers hold dispatch_mutex_ shared from marking a key until it is in
+    // the tree, so every key is either seen by the iterator or marked twice.
+    std::unique_lock<std::shared_mutex> lock(dispatch_mutex_);
+    filter = residency_filters_[2 * partition_num + 1 - residency_active_[partition_num]].get();
+    filter->Reset(bounds);
+    residency_rebuilding_[partition_num] = true;
+    }
+    ReadOptions ropts;
+    ropts.fill_cache = false;
+    std::unique_ptr<ROCKSDB_NAMESPACE::Iterator> iter(db_->NewIterator(ropts, handles_[partition_num]));
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        filter->Add(KeyIndex::ExtractHead64(iter->key()));
+    }
+    std::unique_lock<std::shared_mutex> lock(dispatch_mutex_);
+    if (iter->status().ok()) {
+        residency_active_[partition_num] = 1 - residency_active_[partition_num];
+        residency_ready_[partition_num] = true;
+    }
+    residency_rebuilding_[partition_num] = false;
+}
+
+void LSM2LIX::ResetResidencyRanges(uint32_t partition_num, std::vector<std::pair<uint64_t, uint64_t>> ranges) {
+    ResidencyFilter* filter;
+    {
+    std::unique_lock<std::shared_mutex> lock(dispatch_mutex_);
+    if (!residency_ready_[partition_num]) { // The pending full rebuild sees the detached files gone
+        return;
+    }
+    // Build on a copy of the active filter, which keeps answering until the swap.
+    filter = residency_filters_[2 * partition_num + 1 - residency_active_[partition_num]].get();
+    filter->CopyFrom(*residency_filters_[2 * partition_num + residency_active_[partition_num]]);
+    for (std::pair<uint64_t, uint64_t>& range : ranges) {
+        filter->ClearRange(&range.first, &range.second);
+    }
+    residency_rebuilding_[partition_num] = true;
+    }
+    // Cleared segments are whole, so ranges either coincide or do not overlap.
+    std::sort(ranges.begin(), ranges.end());
+    ranges.erase(std::unique(ranges.begin(), ranges.end()), ranges.end());
+    ReadOptions ropts;
+    ropts.fill_cache = false;
+    std::unique_ptr<ROCKSDB_NAMESPACE::Iterator> iter(db_->NewIterator(ropts, handles_[partition_num]));
+    bool ok = true;
+    for (const std::pair<uint64_t, uint64_t>& range : ranges) {
+        for (iter->Seek(KeyIndex::LowerBoundKey(range.first)); iter->Valid(); iter->Next()) {
+            uint64_t key_num = KeyIndex::ExtractHead64(iter->key());
+            if (key_num > range.second) {
+                break;
+            }
+            filter->Add(key_num);
+        }
+        ok = ok && iter->status().ok();
+    }
+    std::unique_lock<std::shared_mutex> lock(dispatch_mutex_);
+    if (ok) {
+        residency_active_[partition_num] = 1 - residency_active_[partition_num];
+    }
+    residency_rebuilding_[partition_num] = false;
+}
+
+uint64_t LSM2LIX::LIXFileOf(uint64_t key_num) {
+    std::string offset_value;
+    tl::Status tls = tldbs_[LIXOf(key_num)]->Get(key_num, &offset_value);
+    if (!tls.ok()) {
+        return kNoSSTID;
+    }
+    const char* handle_value = offset_value.data();
+    size_t handle_length = offset_value.size();
+    if (inline_values_) { // An inlined value lives in LIX itself, not in any file
+        if (handle_length == 0 || handle_value[0] == INLINE_TAG) {
+            return kNoSSTID;
+        }
+        handle_value++;
+        handle_length--;
+    }
+    uint64_t filenum, offset, size;
+    if (!KeyIndex::DecodeBlockHandle(handle_value, handle_length, &filenum, &offset, &size)) {
+        return kNoSSTID;
+    }
+    return filenum;
+}
+
+Status LSM2LIX::GarbageCollect() {
+    std::vector<uint64_t> candidates;
+    {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    TransID2SSTMeta_.ForEach([&](uint64_t SST_NUM, const SSTableMeta& stm) {
+        if (stm.flag == Normal) {
+            candidates.push_back(SST_NUM);
+        }
+    });
+    }
+    return CollectGarbage(candidates, /*recount*/true);
+}
+
+void LSM2LIX::ScheduleGC(const std::vector<uint64_t>& file_ids) {
+    std::unique_lock<std::mutex> lock(gc_queue_mutex_);
+    if (bg_pool_ == nullptr) { // Transfers replayed while opening
+        return;
+    }
+    gc_candidates_.insert(file_ids.begin(), file_ids.end());
+    if (gc_scheduled_) {
+        return;
+    }
+    gc_scheduled_ = true;
+    bg_pool_->Schedule([this] {
+        std::vector<uint64_t> candidates;
+        {
+        std::unique_lock<std::mutex> lock(gc_queue_mutex_);
+        candidates.assign(gc_candidates_.begin(), gc_candidates_.end());
+        gc_candidates_.clear();
+        gc_scheduled_ = false;
+        }
+        CollectGarbage(candidates, /*recount*/false);
+    });
+}
+
+Status LSM2LIX::CollectGarbage(const std::vector<uint64_t>& candidates, bool recount) {
+    Status status;
+    std::unique_lock<std::mutex> lock(gc_mutex_);
+    for (uint64_t file_id : candidates) {
+        uint64_t flag;
+        if (!TransID2SSTMeta_.GetFlag(file_id, &flag) || flag != Normal) { // Removed by an earlier rewrite
+            continue;
+        }
+        uint32_t live = 0, total = 0;
+        TransID2SSTMeta_.GetEntryCounts(file_id, &live, &total);
+        if (recount || total == 0) { // Not counted since recovery
+            uint64_t live_entries = 0, total_entries = 0;
+            status = CountLiveEntries(file_id, &live_entries, &total_entries);
+            if (!status.ok()) {
+                continue;
+            }
+            live = live_entries;
+            total = total_entries;
+            TransID2SSTMeta_.SetEntryCounts(file_id, live, total);
+        }
+        if (live < lsm2lix_options_.gc_live_ratio * total) {
+            status = RewriteTransFiles({file_id});
+        }
+    }
+    return status;
+}
+
+Status LSM2LIX::CountLiveEntries(uint64_t file_id, uint64_t* live, uint64_t* total) {
+    SstFileReader reader(options_);
+    ROCKSDB_NAMESPACE::Status s = reader.Open(MakeTransFileName(LSM_path_, file_id));
+    if (!s.ok()) {
+        return FromRocksDBStatus(s);
+    }
+    ReadOptions ropts = ropts_;
+    ropts.fill_cache = false;
+    std::unique_ptr<ROCKSDB_NAMESPACE::Iterator> iter(reader.NewIterator(ropts));
+    *live = *total = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        (*total)++;
+        if (LIXFileOf(KeyIndex::ExtractHead64(iter->key())) == file_id) {
+            (*live)++;
+        }
+    }
+    return FromRocksDBStatus(iter->status());
+}
+
+Status LSM2LIX::RewriteTransFiles(const std::vector<uint64_t>& file_ids) {
+    Status status;
+    ROCKSDB_NAMESPACE::Status s;
+    SSTableMeta first;
+    if (file_ids.empty() || !TransID2SSTMeta_.Lookup(file_ids[0], &first)) {
+        return Status::InvalidArgument("Unknown transferred file.");
+    }
+    ReadOptions ropts = ropts_;
+    ropts.fill_cache = false;
+    std::vector<std::unique_ptr<SstFileReader>> readers;
+    std::vector<std::unique_ptr<ROCKSDB_NAMESPACE::Iterator>> iters;
+    uint64_t old_bytes = 0;
+    for (uint64_t file_id : file_ids) {
+        std::string filename = MakeTransFileName(LSM_path_, file_id);
+        readers.emplace_back(new SstFileReader(options_));
+        s = readers.back()->Open(filename);
+        if (!s.ok()) {
+            return FromRocksDBStatus(s);
+        }
+        iters.emplace_back(readers.back()->NewIterator(ropts));
+        iters.back()->SeekToFirst();
+        std::error_code ec;
+        uint64_t bytes = std::filesystem::file_size(filename, ec);
+        old_bytes += ec ? 0 : bytes;
+    }
+
+    // Copy the entries LIX still points at, merging the sources in key order.
+    // A key is live in at most one of them, so the output has no duplicates.
+    uint64_t epoch = lix_epoch_.load();
+    uint64_t new_id = NewTransID();
+    std::string new_name = MakeTransFileName(LSM_path_, new_id);
+    SstFileWriter writer(EnvOptions(), options_);
+    uint64_t smallest_key = 0, largest_key = 0, live = 0;
+    while (s.ok()) {
+        size_t min = iters.size();
+        for (size_t i = 0; i < iters.size(); i++) {
+            if (iters[i]->Valid() && (min == iters.size() || iters[i]->key().compare(iters[min]->key()) < 0)) {
+                min = i;
+            }
+        }
+        if (min == iters.size()) {
+            break;
+        }
+        ROCKSDB_NAMESPACE::Iterator* iter = iters[min].get();
+        uint64_t key_num = KeyIndex::ExtractHead64(iter->key());
+        if (LIXFileOf(key_num) == file_ids[min]) {
+            if (live == 0) {
+                s = writer.Open(new_name);
+                smallest_key = key_num;
+            }
+            if (s.ok()) {
+                s = writer.Put(iter->key(), iter->value());
+            }
+            largest_key = key_num;
+            live++;
+        }
+        iter->Next();
+    }
+    for (size_t i = 0; s.ok() && i < iters.size(); i++) {
+        s = iters[i]->status();
+    }
+    if (s.ok() && live > 0) {
+        s = writer.Finish();
+    }
+    if (!s.ok()) {
+        std::filesystem::remove(new_name);
+        return FromRocksDBStatus(s);
+    }
+
+    uint64_t remapped = 0;
+    if (live > 0) {
+        std::vector<tl::pg::Record> pairs;
+        std::unique_ptr<char[]> offset_values(LSM2LIX_Mover::GetTreeLineIndexPair(new_name, new_id, options_, ropts, GetValueEncoding(), &pairs));
+        if (offset_values == nullptr) {
+            std::filesystem::remove(new_name);
+            return Status::InvalidArgument("Block handles do not fit the handle format.");
+        }
+        { // lock phase
+        // Until every handle is remapped both the new file and its sources hold live entries.
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        SSTableMeta stm = {.SST_ID = kNoSSTID, .cf_id = first.cf_id, .smallest_key = smallest_key, .largest_key = largest_key, .flag = GCing};
+        if (!TransID2SSTMeta_.Insert(new_id, stm)) { // The sources stay as they are
+            std::filesystem::remove(new_name);
+            return Status::NotSupported("Transfer id beyond the capacity of the metatable.");
+        }
+        // Add a record in the mLog
+        char record_buf[60];
+        uint64_t offset = 0;
+        uint64_t record_type = insert;
+        EncodeFixed64(record_buf + offset, record_type);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, new_id);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, stm.SST_ID);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, stm.cf_id);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, smallest_key);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, largest_key);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, static_cast<uint64_t>(GCing));
+        offset += sizeof(uint64_t);
+        mLogWriter_->AddRecord(Slice(record_buf, offset));
+        } // lock phase
+        { // remap phase
+        // Transfers are held off, so a key still pointing at a source has no newer version in LIX.
+        std::unique_lock<std::shared_mutex> remap_lock(lix_remap_mutex_);
+        // Unless a batch entered LIX since the copy started, every copied key is still live.
+        bool recheck = lix_epoch_.load() != epoch;
+        std::vector<std::vector<tl::pg::Record>> runs(lix_cnt_);
+        for (const tl::pg::Record& pair : pairs) {
+            uint64_t filenum = recheck ? LIXFileOf(pair.first) : file_ids[0];
+            if (std::find(file_ids.begin(), file_ids.end(), filenum) != file_ids.end()) {
+                runs[LIXOf(pair.first)].push_back(pair);
+                remapped++;
+            }
+        }
+        for (uint32_t i = 0; i < lix_cnt_; i++) {
+            if (!runs[i].empty() && !tldbs_[i]->PutBatch(runs[i]).ok()) {
+                status = Status::IOError("Batch Load Failed.");
+            }
+            for (size_t j = 0; handle_cache_ != nullptr && j < runs[i].size(); j++) {
+                handle_cache_->Erase(runs[i][j].first);
+            }
+        }
+        } // remap phase
+        if (!status.ok()) { // The sources stay; the partially remapped copy is collected later
+            return status;
+        }
+        { // lock phase
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        TransID2SSTMeta_.SetEntryCounts(new_id, remapped, pairs.size());
+        TransID2SSTMeta_.SetFlag(new_id, Normal);
+        // Add a record in the mLog
+        char record_buf[24];
+        uint64_t offset = 0;
+        uint64_t record_type = modify;
+        EncodeFixed64(record_buf + offset, record_type);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, new_id);
+        offset += sizeof(uint64_t);
+        EncodeFixed64(record_buf + offset, Normal);
+        offset += sizeof(uint64_t);
+        mLogWriter_->AddRecord(Slice(record_buf, offset));
+        } // lock phase
+    }
+
+    // Nothing in LIX points at the sources any more. A Get that read a handle
+    // before the remap finds the file gone and looks the key up again.
+    for (uint64_t file_id : file_ids) {
+        RemoveTransFile(file_id);
+    }
+    gc_files_rewritten_ += file_ids.size();
+    std::error_code ec;
+    uint64_t new_bytes = live > 0 ? std::filesystem::file_size(new_name, ec) : 0;
+    gc_bytes_reclaimed_ += old_bytes - std::min<uint64_t>(old_bytes, ec ? 0 : new_bytes);
+    return status;
+}
+
+Status LSM2LIX::MergeSmallFiles() {
+    Status status;
+    struct SmallFile {
+        uint64_t id;
+        uint64_t cf_id;
+        uint64_t smallest_key;
+        uint64_t size;
+    };
+    std::vector<SmallFile> files;
+    {
+    // Detached files are marked Normal by MarkDetached, so every .tsst file is a candidate.
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    TransID2SSTMeta_.ForEach([&](uint64_t SST_NUM, const SSTableMeta& stm) {
+        if (stm.flag == Normal) {
+            files.push_back({SST_NUM, stm.cf_id, stm.smallest_key, 0});
+        }
+    });
+    }
+    // Stat the files without blocking the metatable writers.
+    size_t kept = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        std::error_code ec;
+        files[i].size = std::filesystem::file_size(MakeTransFileName(LSM_path_, files[i].id), ec);
+        if (!ec && files[i].size < lsm2lix_options_.merge_file_bytes) {
+            files[kept++] = files[i];
+        }
+    }
+    files.resize(kept);
+    // Key-adjacent small files of one column family are merged up to the target file size.
+    std::sort(files.begin(), files.end(), [](const SmallFile& a, const SmallFile& b) {
+        return a.cf_id != b.cf_id ? a.cf_id < b.cf_id : a.smallest_key < b.smallest_key;
+    });
+    std::unique_lock<std::mutex> lock(gc_mutex_);
+    for (size_t begin = 0; begin < files.size();) {
+        std::vector<uint64_t> run;
+        uint64_t run_bytes = 0;
+        size_t end = begin;
+        while (end < files.size() && files[end].cf_id == files[begin].cf_id &&
+               (run.empty() || run_bytes + files[end].size <= options_.target_file_size_base)) {
+            uint64_t flag;
+            if (TransID2SSTMeta_.GetFlag(files[end].id, &flag) && flag == Normal) { // Not collected meanwhile
+                run.push_back(files[end].id);
+                run_bytes += files[end].size;
+            }
+            end++;
+        }
+        if (run.size() > 1) {
+            Status s = RewriteTransFiles(run);
+            if (!s.ok()) {
+                status = s;
+            }
+        }
+        begin = end;
+    }
+    return status;
+}
+
+void LSM2LIX::RemoveTransFile(uint64_t file_id) {
+    {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    TransID2SSTMeta_.Remove(file_id);
+    // Add a record in the mLog
+    char record_buf[16];
+    uint64_t offset = 0;
+    uint64_t record_type = remove;
+    EncodeFixed64(record_buf + offset, record_type);
+    offset += sizeof(uint64_t);
+    EncodeFixed64(record_buf + offset, file_id);
+    offset += sizeof(uint64_t);
+    mLogWriter_->AddRecord(Slice(record_buf, offset));
+    }
+    std::string filename = MakeTransFileName(LSM_path_, file_id);
+    if (file_cache_ != nullptr) {
+        file_cache_->Erase(filename);
+    }
+    std::filesystem::remove(filename);
+}
+
+bool LSM2LIX::SelectColdTransFile(uint32_t cf_id, uint64_t threshold, const std::unordered_set<uint64_t>& tried, uint64_t* old_id) {
+    uint32_t partition_num = PartitionOfCF(cf_id);
+    if (partition_num >= handles_.size() || handles_[partition_num]->GetID() != cf_id) {
+        return false;
+    }
+    ROCKSDB_NAMESPACE::ColumnFamilyMetaData cf_meta;
+    db_->GetColumnFamilyMetaData(handles_[partition_num], &cf_meta);
+    if (cf_meta.levels.empty() || cf_meta.levels.back().size <= threshold) {
+        return false;
+    }
+    std::vector<uint64_t> reads, writes;
+    hotness_->Snapshot(partition_num, &reads, &writes);
+    const ROCKSDB_NAMESPACE::SstFileMetaData* victim = nullptr;
+    uint64_t victim_heat = 0;
+    for (const ROCKSDB_NAMESPACE::SstFileMetaData& file : cf_meta.levels.back().files) {
+        if (file.being_compacted || file.size == 0 || tried.count(file.file_number) > 0) {
+            continue;
+        }
+        uint64_t smallest_key = KeyIndex::ExtractHead64(file.smallestkey);
+        uint64_t largest_key = KeyIndex::ExtractHead64(file.largestkey);
+        uint64_t heat = HotnessTracker::CountInRange(reads, smallest_key, largest_key) +
+                        HotnessTracker::CountInRange(writes, smallest_key, largest_key);
+        // Compare accesses per byte; on a tie the older file goes first.
+        if (victim == nullptr || heat * victim->size < victim_heat * file.size ||
+            (heat * victim->size == victim_heat * file.size && file.file_number < victim->file_number)) {
+            victim = &file;
+            victim_heat = heat;
+        }
+    }
+    if (victim == nullptr) {
+        return false;
+    }
+    *old_id = victim->file_number;
+    return true;
+}
+
+uint32_t LSM2LIX::PartitionOfCF(uint32_t cf_id) const {
+    for (uint32_t i = 0; i < partition_cnt_ && i < handles_.size(); i++) {
+        if (handles_[i]->GetID() == cf_id) {
+            return i;
         }
     }
+    // Handles are created in partition order, so the ids match while the DB is opening.
+    return std::min(cf_id, partition_cnt_ - 1);
 }
 
 uint32_t LSM2LIX::DispatchRequest(uint64_t key_num, uint32_t tree_num)
@@ -543,7 +2353,8 @@ uint32_t LSM2LIX::DispatchRequest(uint64_t key_num, uint32_t tree_num)
     uint64_t max_key_range = std::numeric_limits<uint64_t>::max();
     uint64_t tree_key_range = max_key_range / tree_num;
     uint64_t target_tree = key_num / tree_key_range;
-    return target_tree;
+    // The last (max_key_range % tree_num) keys would otherwise spill into a partition of their own.
+    return std::min(target_tree, static_cast<uint64_t>(tree_num - 1));
 }
 
 } // namespace
\ No newline at end of file
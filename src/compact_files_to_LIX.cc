@@ -1,7 +1,10 @@
 #include "compact_files_to_LIX.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
+#include <unordered_set>
 
 #include "status.h"
 #include "reader.h"
@@ -16,30 +19,90 @@ void LSM2LIX_Mover::OnCompactionCompleted(DB* db, const CompactionJobInfo& info)
     std::string old_name, old_path;
     ROCKSDB_NAMESPACE::Status s;
     if (info.output_level == bottom_level_) {
-        new_id = counter_.fetch_add(1);
-        s = db->SelectTransFile(bottom_level_size_threshold_, &total_size, info.cf_id, &old_id, &old_name, &old_path, new_id, false);
-        while (total_size > bottom_level_size_threshold_) {
-        // while (old_id != std::numeric_limits<uint64_t>::max()) {
-            if (old_id != std::numeric_limits<uint64_t>::max()) {
-                std::string filename = MakeTableFileName(old_path, old_id);
-                std::vector<tl::pg::Record> pairs;
-                char* offset_values = GetTreeLineIndexPair(filename, new_id, options_, rdoptions_, &pairs);
-                Status l2ls = lsm2lix_db_->BatchUpdate_LIX(pairs, old_id, new_id, info.cf_id, /*redo*/false);
-                std::cout << info.cf_id << std::endl;
-                delete offset_values; // release the temp buffer.
-                s = db->DetachSSTFile(info.cf_id, old_id);
-                new_id = counter_.fetch_add(1);
+        lsm2lix_db_->LockTransfer();
+        std::vector<std::pair<uint64_t, uint64_t>> detached_ranges;
+        std::unordered_set<uint64_t> tried; // An SST is attempted at most once per compaction
+        new_id = lsm2lix_db_->NewTransID();
+        if (lsm2lix_db_->HotnessAwareTransfer()) {
+            // Move the coldest SST first; hot ones stay in the LSM-tree while the level allows.
+            while (lsm2lix_db_->SelectColdTransFile(info.cf_id, bottom_level_size_threshold_, tried, &old_id)) {
+                tried.insert(old_id);
+                s = db->SelectTransFile(0, &total_size, info.cf_id, &old_id, &old_name, &old_path, new_id, /*force*/true);
                 if (!s.ok()) {
-                    printf("[Mover] : Detach fiie failed. \n");
+                    break;
                 }
+                if (!TransferFile(db, info.cf_id, old_id, old_path, new_id, &detached_ranges)) {
+                    break;
+                }
+                new_id = lsm2lix_db_->NewTransID();
             }
+        } else {
             s = db->SelectTransFile(bottom_level_size_threshold_, &total_size, info.cf_id, &old_id, &old_name, &old_path, new_id, false);
+            while (total_size > bottom_level_size_threshold_) {
+            // while (old_id != std::numeric_limits<uint64_t>::max()) {
+                if (old_id != std::numeric_limits<uint64_t>::max()) {
+                    if (!tried.insert(old_id).second) { // Picked again, so it did not leave the level
+                        break;
+                    }
+                    if (!TransferFile(db, info.cf_id, old_id, old_path, new_id, &detached_ranges)) {
+                        break;
+                    }
+                    new_id = lsm2lix_db_->NewTransID();
+                }
+                s = db->SelectTransFile(bottom_level_size_threshold_, &total_size, info.cf_id, &old_id, &old_name, &old_path, new_id, false);
+            }
+        }
+        lsm2lix_db_->UnlockTransfer();
+        if (!detached_ranges.empty()) {
+            lsm2lix_db_->OnTransferDone(info.cf_id, detached_ranges);
         }
     }   
 }
 
-char* LSM2LIX_Mover::GetTreeLineIndexPair(std::string& filename, uint64_t filenum, Options& options, ReadOptions& rdoptions, std::vector<tl::pg::Record>* pairs) {
+bool LSM2LIX_Mover::TransferFile(DB* db, uint32_t cf_id, uint64_t old_id, const std::string& old_path, uint64_t new_id,
+                                 std::vector<std::pair<uint64_t, uint64_t>>* detached_ranges) {
+    std::string filename = MakeTableFileName(old_path, old_id);
+    std::vector<tl::pg::Record> pairs;
+    std::vector<std::string> keys;
+    char* offset_values = GetTreeLineIndexPair(filename, new_id, options_, rdoptions_, lsm2lix_db_->GetValueEncoding(), &pairs,
+                                               lsm2lix_db_->PromotionEnabled() ? &keys : nullptr);
+    if (offset_values == nullptr) { // Keep the SST in the LSM-tree rather than corrupt its handles.
+        printf("[Mover] : Block handles of SST %lu do not fit the handle format. \n", old_id);
+        return false;
+    }
+    if (!pairs.empty() && !lsm2lix_db_->MayTransferRange(cf_id, pairs.front().first, pairs.back().first)) {
+        delete[] offset_values; // Still being migrated, retry after the next compaction.
+        return false;
+    }
+    bool has_keys = !pairs.empty();
+    uint64_t smallest_key = has_keys ? pairs.front().first : 0;
+    uint64_t largest_key = has_keys ? pairs.back().first : 0;
+    Status l2ls = lsm2lix_db_->BatchUpdate_LIX(pairs, old_id, new_id, cf_id, /*redo*/false);
+    delete[] offset_values; // release the temp buffer.
+    if (!l2ls.ok()) { // The SST stays in the LSM-tree, which still serves all of its keys.
+        printf("[Mover] : Indexing SST %lu failed: %s \n", old_id, l2ls.ToString().c_str());
+        return false;
+    }
+    ROCKSDB_NAMESPACE::Status s = db->DetachSSTFile(cf_id, old_id);
+    if (!s.ok()) { // Still in the level, so selecting again would pick the same SST
+        printf("[Mover] : Detach fiie failed. \n");
+        return false;
+    }
+    // Renamed to its .tsst name, so rewrites may pick it up
+    lsm2lix_db_->MarkDetached(new_id);
+    lsm2lix_db_->KeepHotKeys(keys); // Written back into the LSM-tree in the background
+    if (has_keys) {
+        detached_ranges->emplace_back(smallest_key, largest_key);
+    }
+    return true;
+}
+
+char* LSM2LIX_Mover::GetTreeLineIndexPair(std::string& filename, uint64_t filenum, Options& options, ReadOptions& rdoptions, const KeyIndex::ValueEncoding& encoding, std::vector<tl::pg::Record>* pairs,
+                                          std::vector<std::string>* keys) {
     pairs->clear();
+    if (keys != nullptr) {
+        keys->clear();
+    }
 
     SstFileReader reader(options);
     reader.Open(filename);
@@ -48,14 +111,41 @@ char* LSM2LIX_Mover::GetTreeLineIndexPair(std::string& filename, uint64_t filenu
     uint64_t num_entries = table_properties->num_entries;
     std::unique_ptr<ROCKSDB_NAMESPACE::Iterator> iter(reader.NewIterator(rdoptions));
     iter->SeekToFirst();
-    char* offset_values = new char[OFFSET_LENGTH * num_entries];
+    size_t max_length = std::max<size_t>(encoding.allow_wide ? WIDE_OFFSET_LENGTH : OFFSET_LENGTH,
+                                         encoding.tagged ? encoding.inline_limit : 0);
+    if (encoding.tagged) {
+        max_length += 1;
+    }
+    char* offset_values = new char[max_length * num_entries];
+    char* offset_value = offset_values;
     uint64_t processed_entries = 0;
     while (iter->Valid()) {
-        std::pair<uint64_t, uint64_t> index_handle = reader.GetInnermostIndex(iter.get());
         uint64_t k = KeyIndex::ExtractHead64(iter->key());
-        char* offset_value = offset_values + processed_entries * OFFSET_LENGTH;
-        KeyIndex::BlockHandleToOffset(filenum, index_handle.first, index_handle.second, offset_value);
-        pairs->emplace_back(k, tl::Slice(offset_value, OFFSET_LENGTH));
+        size_t length;
+        if (encoding.tagged && iter->value().size() < encoding.inline_limit) { // No block read on lookup
+            offset_value[0] = INLINE_TAG;
+            memcpy(offset_value + 1, iter->value().data(), iter->value().size());
+            length = 1 + iter->value().size();
+        } else {
+            std::pair<uint64_t, uint64_t> index_handle = reader.GetInnermostIndex(iter.get());
+            char* handle_value = offset_value;
+            if (encoding.tagged) {
+                *handle_value++ = HANDLE_TAG;
+            }
+            length = KeyIndex::EncodeBlockHandle(filenum, index_handle.first, index_handle.second,
+                                                 encoding.allow_packed, encoding.allow_wide, handle_value);
+            if (length == 0) {
+                delete[] offset_values;
+                pairs->clear();
+                return nullptr;
+            }
+            length += handle_value - offset_value;
+        }
+        pairs->emplace_back(k, tl::Slice(offset_value, length));
+        if (keys != nullptr) {
+            keys->push_back(iter->key().ToString());
+        }
+        offset_value += length;
         processed_entries += 1;
         iter->Next();
     }
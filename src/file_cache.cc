@@ -0,0 +1,101 @@
+#include "file_cache.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace LSM2LIX {
+
+Status MappedFile::Open(const std::string& filename, Access access, std::shared_ptr<MappedFile>* file) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return PosixError(filename, errno);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        Status status = PosixError(filename, errno);
+        ::close(fd);
+        return status;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size == 0) {
+        ::close(fd);
+        return Status::Corruption(filename, "empty file");
+    }
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    int mmap_errno = errno;
+    ::close(fd); // The mapping keeps the file open
+    if (data == MAP_FAILED) {
+        return PosixError(filename, mmap_errno);
+    }
+    ::madvise(data, size, access == kRandom ? MADV_RANDOM : MADV_SEQUENTIAL);
+    file->reset(new MappedFile(static_cast<const char*>(data), size));
+    return Status::OK();
+}
+
+MappedFile::~MappedFile() {
+    ::munmap(const_cast<char*>(data_), size_);
+}
+
+void MappedFile::Prefetch(uint64_t offset, size_t length) const {
+    if (offset >= size_) {
+        return;
+    }
+    // madvise takes a page-aligned start.
+    uint64_t start = offset & ~static_cast<uint64_t>(::getpagesize() - 1);
+    length = std::min<uint64_t>(offset + length, size_) - start;
+    ::madvise(const_cast<char*>(data_) + start, length, MADV_WILLNEED);
+}
+
+FileCache::FileCache(size_t max_files, MappedFile::Access access) : access_(access) {
+    for (size_t i = 0; i < kNumShards; i++) {
+        shards_[i].capacity = std::max<size_t>(max_files / kNumShards, 1);
+    }
+}
+
+Status FileCache::Get(const std::string& filename, std::shared_ptr<MappedFile>* file) {
+    Shard& shard = ShardOf(filename);
+    uint64_t version;
+    {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    auto it = shard.table.find(filename);
+    if (it != shard.table.end()) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        *file = it->second->second;
+        return Status::OK();
+    }
+    version = shard.version;
+    }
+    // Map outside the lock; a racing reader of the same file maps it too.
+    Status status = MappedFile::Open(filename, access_, file);
+    if (!status.ok()) {
+        return status;
+    }
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    if (shard.version != version || shard.table.count(filename) != 0) {
+        return status;
+    }
+    shard.lru.emplace_front(filename, *file);
+    shard.table.emplace(filename, shard.lru.begin());
+    while (shard.lru.size() > shard.capacity) {
+        shard.table.erase(shard.lru.back().first);
+        shard.lru.pop_back();
+    }
+    return status;
+}
+
+void FileCache::Erase(const std::string& filename) {
+    Shard& shard = ShardOf(filename);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    shard.version++;
+    auto it = shard.table.find(filename);
+    if (it != shard.table.end()) {
+        shard.lru.erase(it->second);
+        shard.table.erase(it);
+    }
+}
+
+} // namespace
@@ -0,0 +1,57 @@
+#include "frequency_sketch.h"
+
+#include <algorithm>
+
+#include "coding.h"
+
+namespace LSM2LIX {
+
+FrequencySketch::FrequencySketch(size_t num_bytes)
+        : width_(std::max<size_t>(num_bytes / kDepth, 1)),
+          sample_size_(10 * width_),
+          counters_(new std::atomic<uint8_t>[kDepth * width_]) {
+    for (size_t i = 0; i < kDepth * width_; i++) {
+        counters_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t FrequencySketch::Index(uint64_t hash, int row) const {
+    // Each row takes its own 16-bit slice of the hash, mixed with the row number.
+    uint64_t h = (hash >> (16 * row)) * 0x9e3779b97f4a7c15ULL + row;
+    return row * width_ + (h >> 32) % width_;
+}
+
+uint32_t FrequencySketch::Increment(uint64_t key_num) {
+    uint64_t hash = HashKeyNum(key_num);
+    uint32_t estimate = UINT8_MAX;
+    for (int row = 0; row < kDepth; row++) {
+        std::atomic<uint8_t>& counter = counters_[Index(hash, row)];
+        uint8_t count = counter.load(std::memory_order_relaxed);
+        if (count < UINT8_MAX) {
+            counter.store(++count, std::memory_order_relaxed);
+        }
+        estimate = std::min<uint32_t>(estimate, count);
+    }
+    if (additions_.fetch_add(1, std::memory_order_relaxed) + 1 == sample_size_) {
+        Age();
+    }
+    return estimate;
+}
+
+uint32_t FrequencySketch::Estimate(uint64_t key_num) const {
+    uint64_t hash = HashKeyNum(key_num);
+    uint32_t estimate = UINT8_MAX;
+    for (int row = 0; row < kDepth; row++) {
+        estimate = std::min<uint32_t>(estimate, counters_[Index(hash, row)].load(std::memory_order_relaxed));
+    }
+    return estimate;
+}
+
+void FrequencySketch::Age() {
+    for (size_t i = 0; i < kDepth * width_; i++) {
+        counters_[i].store(counters_[i].load(std::memory_order_relaxed) >> 1, std::memory_order_relaxed);
+    }
+    additions_.store(0, std::memory_order_relaxed);
+}
+
+} // namespace
@@ -0,0 +1,106 @@
+#include "handle_cache.h"
+
+namespace LSM2LIX {
+
+HandleCache::HandleCache(size_t capacity_bytes) {
+    // Round down to a power of two so that a set is picked with a mask.
+    num_sets_ = 1;
+    while (num_sets_ * 2 * sizeof(Set) <= capacity_bytes) {
+        num_sets_ *= 2;
+    }
+    sets_ = new Set[num_sets_];
+    versions_ = new std::atomic<uint64_t>[num_sets_];
+    for (size_t i = 0; i < num_sets_; i++) {
+        for (size_t j = 0; j < kWays; j++) {
+            sets_[i].keys[j].store(0, std::memory_order_relaxed);
+            sets_[i].handles[j].store(0, std::memory_order_relaxed);
+        }
+        versions_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+HandleCache::~HandleCache() {
+    delete[] sets_;
+    delete[] versions_;
+}
+
+size_t HandleCache::SetOf(uint64_t key_num) const {
+    // Fibonacci hashing spreads the clustered keys of a range over all sets.
+    return ((key_num * 0x9E3779B97F4A7C15ULL) >> 20) & (num_sets_ - 1);
+}
+
+void HandleCache::Prefetch(uint64_t key_num) const {
+    size_t set_num = SetOf(key_num);
+    __builtin_prefetch(&versions_[set_num]);
+    __builtin_prefetch(&sets_[set_num]);
+}
+
+bool HandleCache::Lookup(uint64_t key_num, uint64_t* handle, uint64_t* version) const {
+    size_t set_num = SetOf(key_num);
+    const Set& set = sets_[set_num];
+    uint64_t before = versions_[set_num].load(std::memory_order_acquire);
+    *version = before;
+    if (before & 1) {
+        return false;
+    }
+    uint64_t found = 0;
+    for (size_t i = 0; i < kWays && found == 0; i++) {
+        if (set.keys[i].load(std::memory_order_relaxed) == key_num) {
+            found = set.handles[i].load(std::memory_order_relaxed);
+        }
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (found == 0 || versions_[set_num].load(std::memory_order_relaxed) != before) {
+        return false;
+    }
+    *handle = found;
+    return true;
+}
+
+void HandleCache::Insert(uint64_t key_num, uint64_t handle, uint64_t version) {
+    size_t set_num = SetOf(key_num);
+    Set& set = sets_[set_num];
+    std::unique_lock<std::mutex> lock(locks_[set_num % kLockStripes]);
+    uint64_t current = versions_[set_num].load(std::memory_order_relaxed);
+    if (current != version) {
+        return;
+    }
+    // Reuse the slot of the key or an empty one, else evict by rotating on the version.
+    size_t victim = kWays;
+    for (size_t i = 0; i < kWays && victim == kWays; i++) {
+        if (set.keys[i].load(std::memory_order_relaxed) == key_num) {
+            victim = i;
+        }
+    }
+    for (size_t i = 0; i < kWays && victim == kWays; i++) {
+        if (set.handles[i].load(std::memory_order_relaxed) == 0) {
+            victim = i;
+        }
+    }
+    if (victim == kWays) {
+        victim = (current >> 1) % kWays;
+    }
+    versions_[set_num].store(current + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    set.keys[victim].store(key_num, std::memory_order_relaxed);
+    set.handles[victim].store(handle, std::memory_order_relaxed);
+    versions_[set_num].store(current + 2, std::memory_order_release);
+}
+
+void HandleCache::Erase(uint64_t key_num) {
+    size_t set_num = SetOf(key_num);
+    Set& set = sets_[set_num];
+    std::unique_lock<std::mutex> lock(locks_[set_num % kLockStripes]);
+    uint64_t current = versions_[set_num].load(std::memory_order_relaxed);
+    // Bump the version even if the key is absent, to reject in-flight inserts.
+    versions_[set_num].store(current + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < kWays; i++) {
+        if (set.keys[i].load(std::memory_order_relaxed) == key_num) {
+            set.handles[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    versions_[set_num].store(current + 2, std::memory_order_release);
+}
+
+} // namespace
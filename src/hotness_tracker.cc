@@ -0,0 +1,50 @@
+#include "hotness_tracker.h"
+
+#include <algorithm>
+
+namespace LSM2LIX {
+
+HotnessTracker::HotnessTracker(uint32_t num_partitions, uint32_t sample_interval)
+    : sample_interval_(sample_interval == 0 ? 1 : sample_interval), rings_(2 * num_partitions) {
+    for (Ring& ring : rings_) {
+        ring.slots.reset(new std::atomic<uint64_t>[kRingSize]);
+        for (size_t i = 0; i < kRingSize; i++) {
+            ring.slots[i].store(kEmptySlot, std::memory_order_relaxed);
+        }
+    }
+}
+
+void HotnessTracker::Record(uint32_t partition_num, uint64_t key_num, int kind) {
+    static thread_local uint32_t tick = 0;
+    if (++tick < sample_interval_) {
+        return;
+    }
+    tick = 0;
+    Ring& ring = rings_[2 * partition_num + kind];
+    uint64_t slot = ring.next.fetch_add(1, std::memory_order_relaxed) % kRingSize;
+    ring.slots[slot].store(key_num, std::memory_order_relaxed);
+}
+
+void HotnessTracker::Copy(const Ring& ring, std::vector<uint64_t>* samples) const {
+    samples->clear();
+    for (size_t i = 0; i < kRingSize; i++) {
+        uint64_t key_num = ring.slots[i].load(std::memory_order_relaxed);
+        if (key_num != kEmptySlot) {
+            samples->push_back(key_num);
+        }
+    }
+    std::sort(samples->begin(), samples->end());
+}
+
+void HotnessTracker::Snapshot(uint32_t partition_num, std::vector<uint64_t>* reads, std::vector<uint64_t>* writes) const {
+    Copy(rings_[2 * partition_num], reads);
+    Copy(rings_[2 * partition_num + 1], writes);
+}
+
+uint64_t HotnessTracker::CountInRange(const std::vector<uint64_t>& samples, uint64_t smallest_key, uint64_t largest_key) {
+    auto begin = std::lower_bound(samples.begin(), samples.end(), smallest_key);
+    auto end = std::upper_bound(begin, samples.end(), largest_key);
+    return end - begin;
+}
+
+} // namespace
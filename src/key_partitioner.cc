@@ -0,0 +1,85 @@
+#include "key_partitioner.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace LSM2LIX {
+
+void KeyPartitioner::Init(uint32_t num_partitions) {
+    // Same boundaries as LSM2LIX::DispatchRequest.
+    uint64_t tree_key_range = std::numeric_limits<uint64_t>::max() / num_partitions;
+    splits_.clear();
+    for (uint32_t i = 1; i < num_partitions; i++) {
+        splits_.push_back(tree_key_range * i);
+    }
+    prev_splits_.clear();
+}
+
+uint32_t KeyPartitioner::Route(const std::vector<uint64_t>& splits, uint64_t key_num) {
+    return std::upper_bound(splits.begin(), splits.end(), key_num) - splits.begin();
+}
+
+void KeyPartitioner::StartMigration(const std::vector<uint64_t>& splits) {
+    prev_splits_ = splits_;
+    splits_ = splits;
+}
+
+bool KeyPartitioner::Sample(uint64_t key_num, uint32_t sample_interval) {
+    static thread_local uint32_t tick = 0;
+    if (++tick < sample_interval) {
+        return false;
+    }
+    tick = 0;
+    std::unique_lock<std::mutex> lock(sample_mutex_);
+    seen_++;
+    if (reservoir_.size() < kReservoirSize) {
+        reservoir_.push_back(key_num);
+        return false;
+    }
+    uint64_t slot = rng_() % seen_;
+    if (slot < kReservoirSize) {
+        reservoir_[slot] = key_num;
+    }
+    return seen_ % kCheckInterval == 0;
+}
+
+bool KeyPartitioner::ProposeSplits(double threshold, std::vector<uint64_t>* splits) {
+    std::vector<uint64_t> samples;
+    {
+    std::unique_lock<std::mutex> lock(sample_mutex_);
+    samples = reservoir_;
+    }
+    uint32_t num_partitions = NumPartitions();
+    if (num_partitions < 2 || samples.size() < num_partitions) {
+        return false;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    std::vector<uint64_t> counts(num_partitions, 0);
+    for (uint64_t key_num : samples) {
+        counts[Route(key_num)]++;
+    }
+    double fair_share = static_cast<double>(samples.size()) / num_partitions;
+    if (*std::max_element(counts.begin(), counts.end()) <= threshold * fair_share) {
+        return false;
+    }
+
+    splits->clear();
+    for (uint32_t i = 1; i < num_partitions; i++) {
+        uint64_t split = samples[i * samples.size() / num_partitions];
+        // Split points must be strictly increasing even when samples repeat.
+        uint64_t lower_bound = splits->empty() ? 1 : splits->back() + 1;
+        splits->push_back(std::max(split, lower_bound));
+    }
+    if (*splits == splits_) {
+        return false;
+    }
+    {
+    // Let the reservoir follow the distribution seen after the rebalance.
+    std::unique_lock<std::mutex> lock(sample_mutex_);
+    seen_ = reservoir_.size();
+    }
+    return true;
+}
+
+} // namespace
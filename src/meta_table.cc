@@ -0,0 +1,145 @@
+#include "meta_table.h"
+
+namespace LSM2LIX {
+
+MetaTable::MetaTable() : chunks_(new std::atomic<Entry*>[kMaxChunks]) {
+    for (uint64_t i = 0; i < kMaxChunks; i++) {
+        chunks_[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+MetaTable::~MetaTable() {
+    for (uint64_t i = 0; i < kMaxChunks; i++) {
+        delete[] chunks_[i].load(std::memory_order_relaxed);
+    }
+    delete[] chunks_;
+}
+
+MetaTable::Entry* MetaTable::Find(uint64_t id) const {
+    uint64_t chunk_num = id >> kChunkBits;
+    if (chunk_num >= kMaxChunks) {
+        return nullptr;
+    }
+    Entry* chunk = chunks_[chunk_num].load(std::memory_order_acquire);
+    if (chunk == nullptr) {
+        return nullptr;
+    }
+    Entry* entry = &chunk[id & (kChunkSize - 1)];
+    return entry->valid.load(std::memory_order_acquire) ? entry : nullptr;
+}
+
+bool MetaTable::Insert(uint64_t id, const SSTableMeta& meta) {
+    uint64_t chunk_num = id >> kChunkBits;
+    if (chunk_num >= kMaxChunks) {
+        return false;
+    }
+    Entry* chunk = chunks_[chunk_num].load(std::memory_order_acquire);
+    if (chunk == nullptr) {
+        chunk = new Entry[kChunkSize]();
+        chunks_[chunk_num].store(chunk, std::memory_order_release);
+    }
+    Entry* entry = &chunk[id & (kChunkSize - 1)];
+    if (entry->valid.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    count_.fetch_add(1, std::memory_order_release);
+    entry->SST_ID = meta.SST_ID;
+    entry->smallest_key = meta.smallest_key;
+    entry->largest_key = meta.largest_key;
+    entry->cf_id = static_cast<uint32_t>(meta.cf_id);
+    entry->flag.store(static_cast<uint8_t>(meta.flag), std::memory_order_relaxed);
+    entry->live_entries.store(0, std::memory_order_relaxed);
+    entry->total_entries.store(0, std::memory_order_relaxed);
+    entry->valid.store(true, std::memory_order_release);
+    if (id > max_id_.load(std::memory_order_relaxed)) {
+        max_id_.store(id, std::memory_order_release);
+    }
+    return true;
+}
+
+void MetaTable::Remove(uint64_t id) {
+    Entry* entry = Find(id);
+    if (entry != nullptr) {
+        entry->valid.store(false, std::memory_order_release);
+        count_.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void MetaTable::Clear() {
+    for (uint64_t i = 0; i < kMaxChunks; i++) {
+        Entry* chunk = chunks_[i].load(std::memory_order_acquire);
+        for (uint64_t j = 0; chunk != nullptr && j < kChunkSize; j++) {
+            chunk[j].valid.store(false, std::memory_order_release);
+        }
+    }
+    count_.store(0, std::memory_order_release);
+    max_id_.store(0, std::memory_order_release);
+}
+
+bool MetaTable::Lookup(uint64_t id, SSTableMeta* meta) const {
+    Entry* entry = Find(id);
+    if (entry == nullptr) {
+        return false;
+    }
+    meta->SST_ID = entry->SST_ID;
+    meta->cf_id = entry->cf_id;
+    meta->smallest_key = entry->smallest_key;
+    meta->largest_key = entry->largest_key;
+    meta->flag = entry->flag.load(std::memory_order_acquire);
+    return true;
+}
+
+bool MetaTable::GetFlag(uint64_t id, uint64_t* flag) const {
+    Entry* entry = Find(id);
+    if (entry == nullptr) {
+        return false;
+    }
+    *flag = entry->flag.load(std::memory_order_acquire);
+    return true;
+}
+
+void MetaTable::SetFlag(uint64_t id, uint64_t flag) {
+    Entry* entry = Find(id);
+    if (entry != nullptr) {
+        entry->flag.store(static_cast<uint8_t>(flag), std::memory_order_release);
+    }
+}
+
+bool MetaTable::CompareAndSetFlag(uint64_t id, uint64_t expected, uint64_t desired) {
+    Entry* entry = Find(id);
+    if (entry == nullptr) {
+        return false;
+    }
+    uint8_t expected_flag = static_cast<uint8_t>(expected);
+    return entry->flag.compare_exchange_strong(expected_flag, static_cast<uint8_t>(desired), std::memory_order_acq_rel);
+}
+
+void MetaTable::SetEntryCounts(uint64_t id, uint32_t live, uint32_t total) {
+    Entry* entry = Find(id);
+    if (entry != nullptr) {
+        entry->live_entries.store(live, std::memory_order_relaxed);
+        entry->total_entries.store(total, std::memory_order_release);
+    }
+}
+
+bool MetaTable::GetEntryCounts(uint64_t id, uint32_t* live, uint32_t* total) const {
+    Entry* entry = Find(id);
+    if (entry == nullptr) {
+        return false;
+    }
+    *total = entry->total_entries.load(std::memory_order_acquire);
+    *live = entry->live_entries.load(std::memory_order_relaxed);
+    return true;
+}
+
+void MetaTable::DropLiveEntries(uint64_t id, uint32_t count) {
+    Entry* entry = Find(id);
+    if (entry == nullptr) {
+        return;
+    }
+    uint32_t live = entry->live_entries.load(std::memory_order_relaxed);
+    while (!entry->live_entries.compare_exchange_weak(live, live > count ? live - count : 0, std::memory_order_relaxed)) {
+    }
+}
+
+} // namespace
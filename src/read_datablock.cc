@@ -27,9 +27,51 @@ namespace LSM2LIX {
 //     }
 // }
 
+// RocksDB packs the index type of a data block into the top bit of its
+// restart count, and keeps the hash buckets between the restart array and
+// that footer: [entries][restarts][buckets][num_buckets:16][footer:32].
+static const uint32_t kHashIndexBit = 1u << 31;
+static const uint8_t kNoEntry = 255;
+static const uint8_t kCollision = 254;
+static const size_t kSequenceFooterSize = 8;
+
+// RocksDB's GetSliceHash(), a MurmurHash1 variant seeded with 397.
+static uint32_t SliceHash(const Slice& s) {
+    const uint32_t m = 0xc6a4a793;
+    const uint32_t r = 24;
+    const char* data = s.data();
+    const char* limit = data + s.size();
+    uint32_t h = static_cast<uint32_t>(397 ^ (s.size() * m));
+    while (data + 4 <= limit) {
+        uint32_t w = DecodeFixed32(data);
+        data += 4;
+        h += w;
+        h *= m;
+        h ^= (h >> 16);
+    }
+    // Tail bytes are sign-extended, as in RocksDB.
+    switch (limit - data) {
+        case 3:
+            h += static_cast<uint32_t>(static_cast<int8_t>(data[2])) << 16;
+            [[fallthrough]];
+        case 2:
+            h += static_cast<uint32_t>(static_cast<int8_t>(data[1])) << 8;
+            [[fallthrough]];
+        case 1:
+            h += static_cast<uint32_t>(static_cast<int8_t>(data[0]));
+            h *= m;
+            h ^= (h >> r);
+            break;
+    }
+    return h;
+}
+
 inline uint32_t Block::NumRestarts() const {
-    // TODO: check the consistency of the LevelDB and RocksDB
-    return DecodeFixed32(data_ + size_ - sizeof(uint32_t));
+    return DecodeFixed32(data_ + size_ - sizeof(uint32_t)) & ~kHashIndexBit;
+}
+
+inline bool Block::HasHashIndex() const {
+    return (DecodeFixed32(data_ + size_ - sizeof(uint32_t)) & kHashIndexBit) != 0;
 }
 
 Block::Block(const char* data, size_t size)
@@ -38,16 +80,61 @@ Block::Block(const char* data, size_t size)
     if (size_ < sizeof(uint32_t)) {
         size_ = 0;
     } else {
-        size_t max_restarts_allowed = (size_ - sizeof(uint32_t)) / sizeof(uint32_t);
+        size_t map_offset = size_ - sizeof(uint32_t);
+        if (HasHashIndex()) {
+            if (map_offset < sizeof(uint16_t)) {
+                size_ = 0;
+                return;
+            }
+            num_buckets_ = DecodeFixed16(data_ + map_offset - sizeof(uint16_t));
+            if (map_offset < sizeof(uint16_t) + num_buckets_) {
+                size_ = 0;
+                return;
+            }
+            map_offset -= sizeof(uint16_t) + num_buckets_;
+            hash_buckets_ = data_ + map_offset;
+        }
+        size_t max_restarts_allowed = map_offset / sizeof(uint32_t);
         if (NumRestarts() > max_restarts_allowed) {
             // The size is too small for NumRestarts()
             size_ = 0;
         } else {
-            restart_offset_ = size_ - (1 + NumRestarts()) * sizeof(uint32_t);
+            restart_offset_ = map_offset - NumRestarts() * sizeof(uint32_t);
         }
     }
 }
 
+void Block::PrefetchForGet(const Slice& user_key, int stage) const {
+    if (size_ == 0) {
+        return;
+    }
+    uint32_t num_restarts = NumRestarts();
+    if (hash_buckets_ == nullptr || num_buckets_ == 0) { // The binary search starts in the middle
+        const char* restart = data_ + restart_offset_ + (num_restarts / 2) * sizeof(uint32_t);
+        if (stage == 0) {
+            __builtin_prefetch(restart);
+        } else if (stage == 1 && DecodeFixed32(restart) < restart_offset_) {
+            __builtin_prefetch(data_ + DecodeFixed32(restart));
+        }
+        return;
+    }
+    const char* bucket = hash_buckets_ + SliceHash(user_key) % num_buckets_;
+    if (stage == 0) {
+        __builtin_prefetch(bucket);
+        return;
+    }
+    uint8_t entry = static_cast<uint8_t>(*bucket);
+    if (entry == kNoEntry || entry == kCollision || entry >= num_restarts) {
+        return;
+    }
+    const char* restart = data_ + restart_offset_ + entry * sizeof(uint32_t);
+    if (stage == 1) {
+        __builtin_prefetch(restart);
+    } else if (DecodeFixed32(restart) < restart_offset_) {
+        __builtin_prefetch(data_ + DecodeFixed32(restart));
+    }
+}
+
 // Helper routine: decode the next block entry starting at "p",
 // storing the number of shared key bytes, non_shared key bytes,
 // and the length of the value in "*shared", "*non_shared", and
@@ -83,6 +170,8 @@ class Block::Iter : public Iterator{
     const char* const data_;       // underlying block contents
     uint32_t const restarts_;      // Offset of restart array (list of fixed32)
     uint32_t const num_restarts_;  // Number of uint32_t entries in restart array
+    const char* const hash_buckets_;  // nullptr without a hash index
+    uint16_t const num_buckets_;
 
     // current_ is offset in data_ of current entry.  >= restarts_ if !Valid
     uint32_t current_;
@@ -117,11 +206,13 @@ class Block::Iter : public Iterator{
 
  public:
     Iter(const Comparator* comparator, const char* data, uint32_t restarts,
-        uint32_t num_restarts)
+        uint32_t num_restarts, const char* hash_buckets, uint16_t num_buckets)
         : comparator_(comparator),
             data_(data),
             restarts_(restarts),
             num_restarts_(num_restarts),
+            hash_buckets_(hash_buckets),
+            num_buckets_(num_buckets),
             current_(restarts_),
             restart_index_(num_restarts_) {
         assert(num_restarts_ > 0);
@@ -229,6 +320,34 @@ class Block::Iter : public Iterator{
         }
     }
 
+    void SeekForGet(const Slice& user_key) {
+        uint8_t entry = kNoEntry;
+        if (hash_buckets_ != nullptr && num_buckets_ > 0) {
+            entry = static_cast<uint8_t>(hash_buckets_[SliceHash(user_key) % num_buckets_]);
+        }
+        if (entry == kNoEntry || entry == kCollision || entry >= num_restarts_) {
+            Seek(user_key);
+            return;
+        }
+        // Only the restart interval named by the bucket can hold the key.
+        SeekToRestartPoint(entry);
+        uint32_t limit = entry + 1 < num_restarts_ ? GetRestartPoint(entry + 1) : restarts_;
+        while (ParseNextKey() && current_ < limit) {
+            if (key_.size() < kSequenceFooterSize) {
+                break;
+            }
+            int c = Compare(Slice(key_.data(), key_.size() - kSequenceFooterSize), user_key);
+            if (c == 0) {
+                return;
+            }
+            if (c > 0) {
+                break;
+            }
+        }
+        // The hash matched another key of the interval.
+        Seek(user_key);
+    }
+
     void SeekToFirst() {
         SeekToRestartPoint(0);
         ParseNextKey();
@@ -282,7 +401,7 @@ class Block::Iter : public Iterator{
 
 Iterator* Block::NewIterator(const Comparator* comparator) {
     const uint32_t num_restarts = NumRestarts();
-    return new Iter(comparator, data_, restart_offset_, num_restarts);
+    return new Iter(comparator, data_, restart_offset_, num_restarts, hash_buckets_, num_buckets_);
 }
 
 // void Footer::EncodeTo(std::string* dst) const {
@@ -1,17 +1,43 @@
 #include "reader.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string>
 #include <stdlib.h>
 #include <unistd.h>
 
+#ifdef SNAPPY
+#include <snappy.h>
+#endif
+#ifdef LZ4
+#include <lz4.h>
+#endif
+#ifdef ZSTD
+#include <zstd.h>
+#endif
+
 #include "status.h"
 #include "comparator.h"
+#include "coding.h"
+#include "crc32c.h"
 
 namespace LSM2LIX {
 
+// Every block is followed by a 1-byte compression type and the masked
+// crc32c of the block and that byte.
 static const size_t kBlockTrailerSize = 5;
+static const size_t kPageSize = 4096;
+static const size_t kDefaultBufSize = kPageSize * 2;
+
+// Compression types of the block trailer, numbered as in RocksDB.
+enum BlockCompression : char {
+    kUncompressedBlock = 0x0,
+    kSnappyBlock = 0x1,
+    kLZ4Block = 0x4,
+    kLZ4HCBlock = 0x5,
+    kZSTDBlock = 0x7
+};
 
 // Status PosixError(const std::string& context, int error_number) {
 //     if (error_number == ENOENT) {
@@ -38,12 +64,15 @@ Reader::~Reader() {
 
 void Reader::AllocateBuf()
 {
-    buf = aligned_alloc(4096UL, 4096*2);
+    buf = aligned_alloc(kPageSize, kDefaultBufSize);
+    buf_size_ = kDefaultBufSize;
 }
 
 void Reader::FreeBuf()
 {
     free(buf);
+    buf = nullptr;
+    buf_size_ = 0;
 }
 
 void Reader::SetSSTFileName(std::string& filename) {
@@ -51,37 +80,173 @@ void Reader::SetSSTFileName(std::string& filename) {
     fd_ = 0;
 }
 
-Status Reader::ReadBlockContents(BlockHandle& handle) {
+Status Reader::ReadFromFile(const BlockHandle& handle, size_t length) {
     Status status;
+    // An aligned block is read in whole pages, bypassing the page cache.
+    bool direct = direct_io_ && handle.offset_ % kPageSize == 0;
+    size_t read_length = direct ? (length + kPageSize - 1) & ~(kPageSize - 1) : length;
+    if (read_length > buf_size_) { // Blocks of large values outgrow the default buffer
+        FreeBuf();
+        buf_size_ = (read_length + kPageSize - 1) & ~(kPageSize - 1);
+        buf = aligned_alloc(kPageSize, buf_size_);
+    }
     int fd = fd_;
-    // fd = ::open(filename_.c_str(), O_RDONLY | O_DIRECT);
-    fd = ::open(filename_.c_str(), O_RDONLY);
+    fd = ::open(filename_.c_str(), direct ? O_RDONLY | O_DIRECT : O_RDONLY);
+    if (fd < 0 && direct && errno == EINVAL) { // The file system does not support O_DIRECT
+        fd = ::open(filename_.c_str(), O_RDONLY);
+    }
     if (fd < 0) {
         return PosixError(filename_, errno);
     }
-    size_t length = static_cast<size_t>(handle.size_);
-    ssize_t read_size = ::pread(fd, buf, length, static_cast<off_t>(handle.offset_));
+    // A direct read may stop short at the end of the file, past the block.
+    ssize_t read_size = ::pread(fd, buf, read_length, static_cast<off_t>(handle.offset_));
     if (read_size < 0) {
         status = PosixError(filename_, errno);
+    } else if (static_cast<size_t>(read_size) < length) {
+        status = Status::Corruption(filename_, "truncated block read");
     }
     ::close(fd);
-    if (status.ok()) {
-        block_ = new Block((char*)buf, read_size);
-        iter_ = block_->NewIterator(comparator_);
+    return status;
+}
+
+Status Reader::ReadBlockContents(BlockHandle& handle) {
+    Status status;
+    ReleaseBlockContents();
+    size_t block_size = static_cast<size_t>(handle.size_);
+    size_t length = block_size + kBlockTrailerSize;
+    const char* data;
+    if (file_cache_ != nullptr) { // Parse the block in place, in the mapped pages
+        status = file_cache_->Get(filename_, &mapped_);
+        if (!status.ok()) {
+            return status;
+        }
+        if (handle.offset_ > mapped_->size() || mapped_->size() - handle.offset_ < length) {
+            return Status::Corruption(filename_, "block past the end of the file");
+        }
+        data = mapped_->data() + handle.offset_;
+    } else {
+        status = ReadFromFile(handle, length);
+        if (!status.ok()) {
+            return status;
+        }
+        data = static_cast<const char*>(buf);
+    }
+    char type = data[block_size];
+    if (verify_checksums_) {
+        uint32_t expected = CRC32C::Unmask(DecodeFixed32(data + block_size + 1));
+        uint32_t actual = CRC32C::Extend(CRC32C::Value(data, block_size), &type, 1);
+        if (actual != expected) {
+            return Status::Corruption(filename_, "block checksum mismatch");
+        }
     }
+    if (type == kUncompressedBlock) {
+        block_ = new Block(data, block_size);
+    } else {
+        status = UncompressBlock(data, block_size, type);
+        if (!status.ok()) {
+            return status;
+        }
+        block_ = new Block(decompressed_->data(), decompressed_->size());
+    }
+    iter_ = block_->NewIterator(comparator_);
     return status;
 }
 
+void Reader::Prefetch(const BlockHandle& handle) {
+    size_t length = static_cast<size_t>(handle.size_) + kBlockTrailerSize;
+    if (file_cache_ != nullptr) {
+        std::shared_ptr<MappedFile> file;
+        if (file_cache_->Get(filename_, &file).ok()) {
+            file->Prefetch(handle.offset_, length);
+        }
+        return;
+    }
+    if (direct_io_ && handle.offset_ % kPageSize == 0) {
+        return; // Direct reads bypass the page cache the hint would fill
+    }
+    int fd = ::open(filename_.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        ::posix_fadvise(fd, static_cast<off_t>(handle.offset_), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+        ::close(fd);
+    }
+}
+
+void Reader::SetBlockContents(std::shared_ptr<const std::string> contents) {
+    ReleaseBlockContents();
+    decompressed_ = contents;
+    block_ = new Block(decompressed_->data(), decompressed_->size());
+    iter_ = block_->NewIterator(comparator_);
+}
+
+// LZ4 and ZSTD blocks start with the varint32 length of their uncompressed
+// contents (compression format 2); Snappy carries its own.
+Status Reader::UncompressBlock(const char* data, size_t size, char type) {
+    std::shared_ptr<std::string> contents = std::make_shared<std::string>();
+    switch (type) {
+#ifdef SNAPPY
+        case kSnappyBlock: {
+            size_t ulength = 0;
+            if (!snappy::GetUncompressedLength(data, size, &ulength)) {
+                return Status::Corruption(filename_, "malformed snappy block");
+            }
+            contents->resize(ulength);
+            if (!snappy::RawUncompress(data, size, &(*contents)[0])) {
+                return Status::Corruption(filename_, "malformed snappy block");
+            }
+            break;
+        }
+#endif
+#ifdef LZ4
+        case kLZ4Block:
+        case kLZ4HCBlock: {
+            uint32_t ulength = 0;
+            const char* input = GetVarint32Ptr(data, data + size, &ulength);
+            if (input == nullptr) {
+                return Status::Corruption(filename_, "malformed lz4 block");
+            }
+            contents->resize(ulength);
+            int n = LZ4_decompress_safe(input, &(*contents)[0], static_cast<int>(data + size - input), static_cast<int>(ulength));
+            if (n < 0 || static_cast<uint32_t>(n) != ulength) {
+                return Status::Corruption(filename_, "malformed lz4 block");
+            }
+            break;
+        }
+#endif
+#ifdef ZSTD
+        case kZSTDBlock: {
+            uint32_t ulength = 0;
+            const char* input = GetVarint32Ptr(data, data + size, &ulength);
+            if (input == nullptr) {
+                return Status::Corruption(filename_, "malformed zstd block");
+            }
+            contents->resize(ulength);
+            size_t n = ZSTD_decompress(&(*contents)[0], ulength, input, static_cast<size_t>(data + size - input));
+            if (ZSTD_isError(n) || n != ulength) {
+                return Status::Corruption(filename_, "malformed zstd block");
+            }
+            break;
+        }
+#endif
+        default:
+            return Status::NotSupported(filename_, "block compression type is not built in");
+    }
+    decompressed_ = contents;
+    return Status::OK();
+}
+
 void Reader::ReleaseBlockContents() {
-    delete block_;
     delete iter_;
+    delete block_;
     block_ = nullptr;
     iter_ = nullptr;
+    decompressed_.reset();
+    mapped_.reset();
+    buf_pin_.reset();
 }
 
 Status Reader::Get(const Slice& key, std::string* value) {
     Status status;
-    iter_->Seek(key);
+    iter_->SeekForGet(key);
     if (iter_->Valid()) {
         status = Status::OK();
         value->assign(iter_->value().data(), iter_->value().size());
@@ -92,4 +257,25 @@ Status Reader::Get(const Slice& key, std::string* value) {
     return status;
 }
 
+Status Reader::GetPinned(const Slice& key, Slice* value, std::shared_ptr<const void>* pin) {
+    iter_->SeekForGet(key);
+    if (!iter_->Valid()) {
+        return Status::NotFound("Can not find the value corresponding to the target key.");
+    }
+    *value = iter_->value();
+    if (mapped_ != nullptr) {
+        *pin = mapped_;
+    } else if (decompressed_ != nullptr) {
+        *pin = decompressed_;
+    } else {
+        if (buf_pin_ == nullptr) { // The next read allocates a new buffer
+            buf_pin_ = std::shared_ptr<const void>(buf, free);
+            buf = nullptr;
+            buf_size_ = 0;
+        }
+        *pin = buf_pin_;
+    }
+    return Status::OK();
+}
+
 } // namespace Reader
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include "residency_filter.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "coding.h"
+
+namespace LSM2LIX {
+
+ResidencyFilter::ResidencyFilter(size_t num_bytes)
+        : num_words_(std::max<size_t>(num_bytes / sizeof(uint64_t), 1)),
+          words_(new std::atomic<uint64_t>[num_words_]) {
+    Reset({});
+}
+
+uint64_t ResidencyFilter::Mask(uint64_t hash) {
+    // The low 32 bits pick the word, the next 6-bit groups the bits in it.
+    uint64_t mask = 0;
+    for (int i = 0; i < kProbes; i++) {
+        mask |= 1ULL << ((hash >> (32 + 6 * i)) & 63);
+    }
+    return mask;
+}
+
+size_t ResidencyFilter::SegmentOf(uint64_t key_num) const {
+    return std::upper_bound(bounds_.begin(), bounds_.end(), key_num) - bounds_.begin();
+}
+
+std::atomic<uint64_t>& ResidencyFilter::WordOf(uint64_t hash, size_t segment) const {
+    // Segment i owns words [i * n / s, (i + 1) * n / s).
+    size_t segments = bounds_.size() + 1;
+    size_t begin = segment * num_words_ / segments;
+    size_t end = (segment + 1) * num_words_ / segments;
+    return words_[begin + (hash & 0xFFFFFFFF) % (end - begin)];
+}
+
+void ResidencyFilter::Add(uint64_t key_num) {
+    uint64_t hash = HashKeyNum(key_num);
+    WordOf(hash, SegmentOf(key_num)).fetch_or(Mask(hash), std::memory_order_relaxed);
+}
+
+bool ResidencyFilter::MayContain(uint64_t key_num) const {
+    uint64_t hash = HashKeyNum(key_num);
+    uint64_t mask = Mask(hash);
+    return (WordOf(hash, SegmentOf(key_num)).load(std::memory_order_relaxed) & mask) == mask;
+}
+
+void ResidencyFilter::Reset(const std::vector<uint64_t>& bounds) {
+    bounds_.clear();
+    // Every segment needs a word of its own; thin out the bounds evenly beyond that.
+    size_t max_bounds = std::min(kMaxSegments, num_words_) - 1;
+    size_t step = bounds.size() > max_bounds ? (max_bounds == 0 ? bounds.size() + 1 : (bounds.size() + max_bounds - 1) / max_bounds) : 1;
+    for (size_t i = step - 1; i < bounds.size(); i += step) {
+        if (bounds[i] > 0 && (bounds_.empty() || bounds[i] > bounds_.back())) {
+            bounds_.push_back(bounds[i]);
+        }
+    }
+    for (size_t i = 0; i < num_words_; i++) {
+        words_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void ResidencyFilter::CopyFrom(const ResidencyFilter& other) {
+    // Both filters of a partition have the same size.
+    bounds_ = other.bounds_;
+    for (size_t i = 0; i < num_words_; i++) {
+        words_[i].store(other.words_[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+void ResidencyFilter::ClearRange(uint64_t* smallest_key, uint64_t* largest_key) {
+    size_t first = SegmentOf(*smallest_key);
+    size_t last = SegmentOf(*largest_key);
+    size_t segments = bounds_.size() + 1;
+    for (size_t i = first * num_words_ / segments; i < (last + 1) * num_words_ / segments; i++) {
+        words_[i].store(0, std::memory_order_relaxed);
+    }
+    *smallest_key = first == 0 ? 0 : bounds_[first - 1];
+    *largest_key = last == bounds_.size() ? std::numeric_limits<uint64_t>::max() : bounds_[last] - 1;
+}
+
+} // namespace
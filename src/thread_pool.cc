@@ -0,0 +1,46 @@
+#include "thread_pool.h"
+
+namespace LSM2LIX {
+
+ThreadPool::ThreadPool(size_t num_threads) {
+    for (size_t i = 0; i < num_threads; i++) {
+        threads_.emplace_back(&ThreadPool::Run, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::Schedule(std::function<void()> task) {
+    {
+    std::unique_lock<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+void ThreadPool::Run() {
+    while (true) {
+        std::function<void()> task;
+        {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+        if (tasks_.empty()) { // stop_ is set and the queue is drained
+            return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+} // namespace
@@ -3,13 +3,16 @@
 #include "rocksdb/sst_file_writer.h"
 #include "rocksdb/options.h"
 
+#include <cassert>
 #include <cinttypes>
+#include <filesystem>
 #include <string>
 #include <iostream>
 
 #include "reader.h"
 #include "compact_files_to_LIX.h"
 #include "coding.h"
+#include "comparator.h"
 #include "key_index.h"
 #include "LSM2LIX.h"
 
@@ -152,8 +155,134 @@ void DetachSST_TEST() {
     delete db;
 }
 */
+
+void BlockHandle_TEST() {
+    char buf[WIDE_OFFSET_LENGTH];
+    uint64_t filenum, offset, size;
+    // Fits the compact layout.
+    // Calls are kept out of assert(), so the test still runs them under NDEBUG.
+    size_t length = KeyIndex::EncodeBlockHandle(1000, 1 << 20, 4096, false, false, buf);
+    assert(length == OFFSET_LENGTH);
+    bool decoded = KeyIndex::DecodeBlockHandle(buf, length, &filenum, &offset, &size);
+    assert(decoded && filenum == 1000 && offset == (1 << 20) && size == 4096);
+    // An offset past 1GB needs the wide layout.
+    length = KeyIndex::EncodeBlockHandle(1 << 20, 3ULL << 30, 1 << 17, true, false, buf);
+    assert(length == 0);
+    length = KeyIndex::EncodeBlockHandle(1 << 20, 3ULL << 30, 1 << 17, true, true, buf);
+    assert(length == WIDE_OFFSET_LENGTH);
+    decoded = KeyIndex::DecodeBlockHandle(buf, length, &filenum, &offset, &size);
+    assert(decoded && filenum == (1 << 20) && offset == (3ULL << 30) && size == (1 << 17));
+    // An aligned block of a small file packs into 5 bytes, an unaligned one does not.
+    length = KeyIndex::EncodeBlockHandle(1000, 12 * 4096, 4000, true, true, buf);
+    assert(length == PACKED_OFFSET_LENGTH);
+    decoded = KeyIndex::DecodeBlockHandle(buf, length, &filenum, &offset, &size);
+    assert(decoded && filenum == 1000 && offset == 12 * 4096 && size == 4000);
+    length = KeyIndex::EncodeBlockHandle(1000, 12 * 4096 + 17, 4000, true, true, buf);
+    assert(length == OFFSET_LENGTH);
+    // Past the 16K ids of the 5-byte layout, a packed handle takes 6 bytes.
+    length = KeyIndex::EncodeBlockHandle(100000, 12 * 4096, 4000, true, true, buf);
+    assert(length == PACKED_WIDE_OFFSET_LENGTH);
+    decoded = KeyIndex::DecodeBlockHandle(buf, length, &filenum, &offset, &size);
+    assert(decoded && filenum == 100000 && offset == 12 * 4096 && size == 4000);
+    (void)decoded;
+    printf("BlockHandle_TEST passed\n");
+}
+
+void DataBlockHashIndex_TEST() {
+    // Two restart intervals of one entry each, keyed by internal keys.
+    std::string block;
+    const char* user_keys[] = {"a", "b"};
+    uint32_t restarts[2];
+    for (int i = 0; i < 2; i++) {
+        restarts[i] = block.size();
+        block.push_back(0);
+        block.push_back(9);
+        block.push_back(1);
+        block.append(user_keys[i]);
+        block.append(8, '\0');
+        block.push_back('1' + i);
+    }
+    for (int i = 0; i < 2; i++) {
+        LSM2LIX::PutFixed32(&block, restarts[i]);
+    }
+    // A single bucket, so both keys hash to the first interval.
+    block.push_back(0);
+    block.push_back(1);
+    block.push_back(0);
+    LSM2LIX::PutFixed32(&block, 2 | (1u << 31));
+    LSM2LIX::Block data_block(block.data(), block.size());
+    LSM2LIX::Iterator* iter = data_block.NewIterator(LSM2LIX::BytewiseComparator());
+    iter->SeekForGet(LSM2LIX::Slice("a"));
+    assert(iter->Valid() && iter->value() == LSM2LIX::Slice("1"));
+    // Not in the interval of its bucket, so found by binary search.
+    iter->SeekForGet(LSM2LIX::Slice("b"));
+    assert(iter->Valid() && iter->value() == LSM2LIX::Slice("2"));
+    delete iter;
+    printf("DataBlockHashIndex_TEST passed\n");
+}
+
+void MultiGet_TEST() {
+    std::filesystem::remove_all(kDBPath);
+    std::filesystem::create_directories(kDBPath);
+    // Even keys get values short enough to be inlined into LIX, odd keys block handles.
+    std::string source = kDBPath + "/ingest.sst";
+    // Calls are kept out of assert(), so the test still runs them under NDEBUG.
+    SstFileWriter writer(soptions_, options_);
+    Status s = writer.Open(source);
+    assert(s.ok());
+    for (uint64_t i = 0; i < 1000; i++) {
+        std::string value = i % 2 == 0 ? std::to_string(i) : std::string(100, 'a' + i % 26);
+        s = writer.Put(KeyIndex::IntKeyAsSlice(i).as<ROCKSDB_NAMESPACE::Slice>(), value);
+        assert(s.ok());
+    }
+    s = writer.Finish();
+    assert(s.ok());
+    LSM2LIX::LSM2LIXOptions lsm2lix_options;
+    lsm2lix_options.inline_value_bytes = 16;
+    LSM2LIX::LSM2LIX* db = nullptr;
+    LSM2LIX::Status status = LSM2LIX::LSM2LIX::Open(lsm2lix_options, kDBPath, &db);
+    assert(status.ok());
+    SstFileReader reader(options_);
+    s = reader.Open(source);
+    assert(s.ok());
+    std::unique_ptr<Iterator> iter(reader.NewIterator(ReadOptions()));
+    status = db->IngestSorted(iter.get());
+    assert(status.ok());
+    // Newer versions of some of them stay in the LSM-trees.
+    for (uint64_t i = 500; i < 550; i++) {
+        status = db->Put(i, "lsm" + std::to_string(i));
+        assert(status.ok());
+    }
+
+    std::vector<KeyIndex::IntKeyAsSlice> int_keys;
+    for (uint64_t i = 0; i < 1000; i += 7) {
+        int_keys.emplace_back(i);
+    }
+    int_keys.emplace_back(5000); // Missing
+    std::vector<ROCKSDB_NAMESPACE::Slice> keys;
+    for (const KeyIndex::IntKeyAsSlice& key : int_keys) {
+        keys.push_back(key.as<ROCKSDB_NAMESPACE::Slice>());
+    }
+    std::vector<ROCKSDB_NAMESPACE::PinnableSlice> values(keys.size());
+    std::vector<LSM2LIX::Status> statuses(keys.size());
+    db->MultiGet(keys.size(), keys.data(), values.data(), statuses.data());
+    for (size_t i = 0; i < keys.size(); i++) {
+        ROCKSDB_NAMESPACE::PinnableSlice value;
+        status = db->Get(keys[i], &value);
+        assert(status.ok() == statuses[i].ok() && status.IsNotFound() == statuses[i].IsNotFound());
+        assert(!status.ok() || value.ToString() == values[i].ToString());
+    }
+    assert(statuses.back().IsNotFound());
+    delete db;
+    printf("MultiGet_TEST passed\n");
+}
+
 int main(){
     //DetachSST_TEST();
+    // These only touch kDBPath; CheckSST_TEST needs file_path to be writable.
+    BlockHandle_TEST();
+    DataBlockHashIndex_TEST();
+    MultiGet_TEST();
     CheckSST_TEST();
     return 0;
 }
\ No newline at end of file